@@ -0,0 +1,260 @@
+#define REDISMODULE_EXPERIMENTAL_API
+#include <string.h>
+#include "cache.h"
+#include "config.h"
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
+/* Fields the cache re-reads before a hash is cheaper to read again whole */
+#define MAX_DIRTY(numDocs) ((numDocs) / 2 + 16)
+
+struct parseCacheEntry {
+  char *name;     // see NRIndex_HashName
+  size_t nameLen;
+  NRIndex *idx;
+  Dict *dirty;    // fields written since idx was last brought up to date
+  size_t numFields;  // length of the hash at the last search, the docs are a worker's business
+  int filling;    // a search is reading the hash, the entry is not in the LRU list yet
+  int stale;      // written in a way we can't track while filling, dropped once filled
+  size_t mem;
+  struct parseCacheEntry *prev, *next;  // LRU list, most recently searched first
+};
+
+static struct {
+  Dict *entries;  // name -> entry, NULL while the cache is off
+  ParseCacheEntry *head, *tail;
+  ParseCacheStats stats;
+  size_t docMem;  // bytes per doc of the last hash filled, to skip hashes that can't fit
+} cache;
+
+static ParseCacheEntry *lookup(RedisModuleCtx *ctx, RedisModuleString *hashKey) {
+  if (cache.entries == NULL || Dict_Size(cache.entries) == 0) return NULL;
+
+  char buf[NR_NAME_BUF_SIZE];
+  size_t len;
+  char *name = NRIndex_HashName(ctx, hashKey, buf, &len);
+  ParseCacheEntry *e = Dict_Get(cache.entries, name, len);
+  if (name != buf) RedisModule_Free(name);
+  return e;
+}
+
+static void unlinkEntry(ParseCacheEntry *e) {
+  if (e->prev) e->prev->next = e->next;
+  else cache.head = e->next;
+  if (e->next) e->next->prev = e->prev;
+  else cache.tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void linkFirst(ParseCacheEntry *e) {
+  e->prev = NULL;
+  e->next = cache.head;
+  if (cache.head) cache.head->prev = e;
+  cache.head = e;
+  if (cache.tail == NULL) cache.tail = e;
+}
+
+/* Searches still running on the docs keep them alive through their reference */
+static void dropEntry(ParseCacheEntry *e) {
+  Dict_Delete(cache.entries, e->name, e->nameLen);
+  if (!e->filling) {
+    unlinkEntry(e);
+    cache.stats.memory -= e->mem;
+  }
+  NRIndex_Release(e->idx);
+  Dict_Free(e->dirty, NULL);
+  RedisModule_Free(e->name);
+  RedisModule_Free(e);
+}
+
+static void updateMemUsage(ParseCacheEntry *e) {
+  cache.stats.memory -= e->mem;
+  e->mem = sizeof(ParseCacheEntry) + e->nameLen + NRIndex_MemUsage(e->idx);
+  cache.stats.memory += e->mem;
+}
+
+/* Queue the fields written since the last search, which applies them, O(fields written) */
+static void refresh(RedisModuleCtx *ctx, ParseCacheEntry *e, RedisModuleString *hashKey) {
+  RedisModuleKey *key = RedisModule_OpenKey(ctx, hashKey, REDISMODULE_READ);
+  DictIterator it = Dict_Iterate(e->dirty);
+  DictEntry *field;
+  while ((field = DictIterator_Next(&it))) {
+    NRIndex_QueueHashField(e->idx, ctx, key, field->key, field->len);
+  }
+  RedisModule_CloseKey(key);
+
+  Dict_Free(e->dirty, NULL);
+  e->dirty = NewDict(16);
+}
+
+void ParseCache_Init() {
+  cache.entries = NewDict(64);
+}
+
+NRIndex *ParseCache_Get(RedisModuleCtx *ctx, RedisModuleString *hashKey, NRIndexMark *mark) {
+  ParseCacheEntry *e = lookup(ctx, hashKey);
+  if (e == NULL || e->filling) {
+    cache.stats.misses++;
+    return NULL;
+  }
+
+  int written = Dict_Size(e->dirty) > 0;
+  if (written) {
+    refresh(ctx, e, hashKey);
+  }
+  NRIndex_Mark(e->idx, ctx, hashKey, mark);
+  e->numFields = mark->numFields;
+
+  cache.stats.hits++;
+  NRIndex *idx = e->idx;
+  NRIndex_Retain(idx);
+  unlinkEntry(e);
+  linkFirst(e);
+  // the docs may have grown, which can evict this very entry. The search keeps its reference
+  if (written) {
+    updateMemUsage(e);
+    ParseCache_Trim(nrConfig.parseCacheMemory);
+  }
+  return idx;
+}
+
+ParseCacheEntry *ParseCache_StartFill(RedisModuleCtx *ctx, RedisModuleString *hashKey) {
+  if (cache.entries == NULL || nrConfig.parseCacheMemory == 0) return NULL;
+
+  RedisModuleKey *key = RedisModule_OpenKey(ctx, hashKey, REDISMODULE_READ);
+  int type = RedisModule_KeyType(key);
+  size_t numFields = type == REDISMODULE_KEYTYPE_HASH ? RedisModule_ValueLength(key) : 0;
+  RedisModule_CloseKey(key);
+  // a hash that would be evicted as soon as it is filled is only scanned
+  if (type != REDISMODULE_KEYTYPE_HASH ||
+      numFields * cache.docMem > (size_t)nrConfig.parseCacheMemory) {
+    return NULL;
+  }
+
+  char buf[NR_NAME_BUF_SIZE];
+  size_t len;
+  char *name = NRIndex_HashName(ctx, hashKey, buf, &len);
+  ParseCacheEntry *e = NULL;
+  if (Dict_Get(cache.entries, name, len) == NULL) {
+    e = RedisModule_Calloc(1, sizeof(ParseCacheEntry));
+    e->name = RedisModule_Alloc(len);
+    memcpy(e->name, name, len);
+    e->nameLen = len;
+    e->idx = NewNRIndex();
+    e->dirty = NewDict(16);
+    e->filling = 1;
+    Dict_Set(cache.entries, e->name, len, e);
+  }
+  if (name != buf) RedisModule_Free(name);
+  return e;
+}
+
+NRIndex *ParseCache_Fill(RedisModuleCtx *ctx, ParseCacheEntry *e, RedisModuleString *hashKey,
+                         NRIndexMark *mark) {
+  char cursor[32] = "0";
+  size_t len;
+  int ok = 1;
+
+  // no search sees the docs before they are filled, they need no lock
+  do {
+    RedisModule_ThreadSafeContextLock(ctx);
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, "HSCAN", "sccl", hashKey, cursor, "COUNT",
+                                                   (long long)NR_SCAN_CHUNK_SIZE);
+    RedisModule_ThreadSafeContextUnlock(ctx);
+
+    if (reply == NULL || RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY) {
+      if (reply) RedisModule_FreeCallReply(reply);
+      ok = 0;
+      break;
+    }
+
+    const char *next = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply, 0),
+                                                      &len);
+    len = min(len, sizeof(cursor) - 1);
+    memcpy(cursor, next, len);
+    cursor[len] = '\0';
+    // a field HSCAN returns twice is only replaced
+    NRIndex_LoadHashReply(e->idx, RedisModule_CallReplyArrayElement(reply, 1));
+    RedisModule_FreeCallReply(reply);
+  } while (strcmp(cursor, "0") != 0);
+
+  // measured while the docs are still ours, it walks all of them
+  if (ok) NRIndex_UpdateMemUsage(e->idx);
+
+  RedisModule_ThreadSafeContextLock(ctx);
+  NRIndex *idx = ok ? e->idx : NULL;
+  if (idx) {
+    NRIndex_Retain(idx);
+    // the fields written while the hash was read may have been read before the write
+    refresh(ctx, e, hashKey);
+    NRIndex_Mark(idx, ctx, hashKey, mark);
+    e->numFields = mark->numFields;
+  }
+
+  e->filling = 0;
+  linkFirst(e);
+  if (!ok || e->stale) {
+    dropEntry(e);
+  } else {
+    updateMemUsage(e);
+    if (e->idx->numDocs > 0) cache.docMem = e->mem / e->idx->numDocs;
+    ParseCache_Trim(nrConfig.parseCacheMemory);
+  }
+  RedisModule_ThreadSafeContextUnlock(ctx);
+  return idx;
+}
+
+void ParseCache_MarkDirty(RedisModuleCtx *ctx, RedisModuleString *hashKey, const char *field,
+                          size_t len) {
+  ParseCacheEntry *e = lookup(ctx, hashKey);
+  if (e == NULL) return;
+
+  Dict_Set(e->dirty, field, len, NULL);
+  if (!e->filling && Dict_Size(e->dirty) > MAX_DIRTY(e->numFields)) {
+    dropEntry(e);
+  }
+}
+
+void ParseCache_Invalidate(RedisModuleCtx *ctx, RedisModuleString *hashKey) {
+  ParseCacheEntry *e = lookup(ctx, hashKey);
+  if (e == NULL) return;
+
+  if (e->filling) {
+    e->stale = 1;
+  } else {
+    dropEntry(e);
+  }
+}
+
+void ParseCache_FlushDb(int db) {
+  if (cache.entries == NULL) return;
+
+  Vector *flushed = NewVector(ParseCacheEntry *, 8);
+  DictIterator it = Dict_Iterate(cache.entries);
+  DictEntry *entry;
+  while ((entry = DictIterator_Next(&it))) {
+    if (db == -1 || NRIndex_NameDb(entry->key) == db) Vector_Push(flushed, entry->val);
+  }
+  ParseCacheEntry *e;
+  for (size_t i = 0; i < Vector_Size(flushed); i++) {
+    Vector_Get(flushed, i, &e);
+    if (e->filling) {
+      e->stale = 1;
+    } else {
+      dropEntry(e);
+    }
+  }
+  Vector_Free(flushed);
+}
+
+void ParseCache_Trim(long long maxMemory) {
+  while (cache.tail && cache.stats.memory > (size_t)maxMemory) {
+    dropEntry(cache.tail);
+    cache.stats.evictions++;
+  }
+}
+
+void ParseCache_GetStats(ParseCacheStats *stats) {
+  *stats = cache.stats;
+  stats->hashes = cache.entries ? Dict_Size(cache.entries) : 0;
+}
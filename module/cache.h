@@ -0,0 +1,65 @@
+#ifndef __NR_CACHE_H__
+#define __NR_CACHE_H__
+
+#include "../redismodule.h"
+#include "index.h"
+
+/*
+* Parsed docs of the hashes searched without an index, so a search only parses
+* what changed since the previous one. The first search of a hash reads it
+* whole into an NRIndex, as NR.INDEX would but with HSCAN, and searches that
+* instead of the values. Keyspace notifications then record the fields written
+* to the hash, and the next search queues just those on the docs and applies
+* them on its worker. Writes that can't be tracked by field drop the hash from
+* the cache.
+*
+* The memory of the cached hashes is capped by the PARSE_CACHE_MEMORY setting,
+* the least recently searched ones are evicted first. Everything here must be
+* called with the GIL held, except ParseCache_Fill.
+*/
+
+typedef struct parseCacheEntry ParseCacheEntry;
+
+typedef struct {
+  size_t hashes;
+  size_t memory;
+  long long hits;       // searches answered from cached docs
+  long long misses;     // searches that had to read the hash
+  long long evictions;  // hashes dropped to stay under the memory cap
+} ParseCacheStats;
+
+/* Start caching, only called once writes to hashes are tracked by Keyspace_Subscribe */
+void ParseCache_Init();
+
+/* Return the cached docs of hashKey, retained for the caller, or NULL if they
+ * aren't cached. The fields written since the last search are queued on them
+ * and mark is set for NRIndex_Apply to bring them up to date */
+NRIndex *ParseCache_Get(RedisModuleCtx *ctx, RedisModuleString *hashKey, NRIndexMark *mark);
+
+/* Add hashKey to the cache, to be filled by ParseCache_Fill. Returns NULL if
+ * the cache is off, the key is not a hash or another search is filling it */
+ParseCacheEntry *ParseCache_StartFill(RedisModuleCtx *ctx, RedisModuleString *hashKey);
+
+/* Read the hash into e with HSCAN, only taking the GIL while a chunk is
+ * fetched. Returns the docs, retained for the caller and with mark set like
+ * ParseCache_Get, or NULL if the hash could not be read. They are kept in the
+ * cache unless the hash was written in a way that can't be tracked meanwhile */
+NRIndex *ParseCache_Fill(RedisModuleCtx *ctx, ParseCacheEntry *e, RedisModuleString *hashKey,
+                         NRIndexMark *mark);
+
+/* Record that field of hashKey was written, if the hash is cached */
+void ParseCache_MarkDirty(RedisModuleCtx *ctx, RedisModuleString *hashKey, const char *field,
+                          size_t len);
+
+/* Drop hashKey from the cache, e.g. once it is deleted or has an index */
+void ParseCache_Invalidate(RedisModuleCtx *ctx, RedisModuleString *hashKey);
+
+/* Drop the hashes of db, of every db if db is -1, e.g. once it is flushed */
+void ParseCache_FlushDb(int db);
+
+/* Evict the least recently searched hashes until the cache takes at most maxMemory bytes */
+void ParseCache_Trim(long long maxMemory);
+
+void ParseCache_GetStats(ParseCacheStats *stats);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include "config.h"
+#include "../rmutil/util.h"
+#include "../rmutil/strings.h"
+#include "../rmutil/thread_pool.h"
+#include "cache.h"
+
+NRConfig nrConfig = {
+    .workers = NR_DEFAULT_WORKERS,
+    .queueSize = TPOOL_QUEUE_SIZE,
+    .maxQueued = 0,
+    .maxQueueAge = 0,
+    .parseCacheMemory = NR_DEFAULT_PARSE_CACHE_MEMORY,
+};
+
+/* For settings that are read where they are used */
+static int applyValue(long long value) {
+  return REDISMODULE_OK;
+}
+
+static int applyWorkers(long long value) {
+  if (tpool_resize((int)value) != 0) {
+    // the pool may have grown part of the way
+    nrConfig.workers = tpool_num_threads();
+    return REDISMODULE_ERR;
+  }
+  return REDISMODULE_OK;
+}
+
+static int applyParseCacheMemory(long long value) {
+  ParseCache_Trim(value);
+  return REDISMODULE_OK;
+}
+
+typedef struct {
+  const char *name;
+  long long *value;
+  long long min;
+  long long max;
+  int (*apply)(long long value);  // NULL if the setting can only be given at load time
+} configOption;
+
+static configOption options[] = {
+    {"WORKERS", &nrConfig.workers, 1, NR_MAX_WORKERS, applyWorkers},
+    {"QUEUE_SIZE", &nrConfig.queueSize, 1, 1 << 24, NULL},
+    {"MAX_QUEUED", &nrConfig.maxQueued, 0, 1 << 24, applyValue},
+    {"MAX_QUEUE_AGE", &nrConfig.maxQueueAge, 0, 24 * 3600 * 1000, applyValue},
+    {"PARSE_CACHE_MEMORY", &nrConfig.parseCacheMemory, 0, 1LL << 40, applyParseCacheMemory},
+};
+
+#define NUM_OPTIONS (sizeof(options) / sizeof(options[0]))
+
+static configOption *findOption(RedisModuleString *name) {
+  for (size_t i = 0; i < NUM_OPTIONS; i++) {
+    if (RMUtil_StringEqualsCaseC(name, options[i].name)) return &options[i];
+  }
+  return NULL;
+}
+
+int NRConfig_Load(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  for (size_t i = 0; i < NUM_OPTIONS; i++) {
+    configOption *opt = &options[i];
+    if (RMUtil_ArgIndex(opt->name, argv, argc) < 0) continue;
+
+    long long value;
+    if (RMUtil_ParseArgsAfter(opt->name, argv, argc, "l", &value) != REDISMODULE_OK ||
+        value < opt->min || value > opt->max) {
+      RedisModule_Log(ctx, "warning", "%s must be an integer between %lld and %lld", opt->name,
+                      opt->min, opt->max);
+      return REDISMODULE_ERR;
+    }
+    *opt->value = value;
+  }
+  return REDISMODULE_OK;
+}
+
+int NRConfigCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 3) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  if (RMUtil_StringEqualsCaseC(argv[1], "GET")) {
+    if (argc != 3) return RedisModule_WrongArity(ctx);
+    int all = RMUtil_StringEqualsC(argv[2], "*");
+    configOption *opt = all ? NULL : findOption(argv[2]);
+    size_t n = all ? NUM_OPTIONS : (opt ? 1 : 0);
+
+    RedisModule_ReplyWithArray(ctx, n * 2);
+    for (size_t i = 0; i < n; i++) {
+      configOption *o = all ? &options[i] : opt;
+      RedisModule_ReplyWithSimpleString(ctx, o->name);
+      RedisModule_ReplyWithLongLong(ctx, *o->value);
+    }
+    return REDISMODULE_OK;
+  }
+
+  if (RMUtil_StringEqualsCaseC(argv[1], "SET")) {
+    if (argc != 4) return RedisModule_WrongArity(ctx);
+    configOption *opt = findOption(argv[2]);
+    if (opt == NULL) {
+      return RedisModule_ReplyWithError(ctx, "ERR unknown setting");
+    }
+    if (opt->apply == NULL) {
+      return RedisModule_ReplyWithError(ctx, "ERR setting can only be given at load time");
+    }
+
+    long long value;
+    if (RedisModule_StringToLongLong(argv[3], &value) != REDISMODULE_OK || value < opt->min ||
+        value > opt->max) {
+      char err[128];
+      snprintf(err, sizeof(err), "ERR %s must be an integer between %lld and %lld", opt->name,
+               opt->min, opt->max);
+      return RedisModule_ReplyWithError(ctx, err);
+    }
+    if (opt->apply(value) != REDISMODULE_OK) {
+      return RedisModule_ReplyWithError(ctx, "ERR could not apply the setting");
+    }
+    *opt->value = value;
+    return RedisModule_ReplyWithSimpleString(ctx, "OK");
+  }
+
+  return RedisModule_ReplyWithError(ctx, "ERR syntax error");
+}
@@ -0,0 +1,38 @@
+#ifndef __NR_CONFIG_H__
+#define __NR_CONFIG_H__
+
+#include "../redismodule.h"
+
+#define NR_DEFAULT_WORKERS 6
+#define NR_MAX_WORKERS 1024
+#define NR_DEFAULT_PARSE_CACHE_MEMORY (64LL << 20)
+
+/* Module settings, given as load arguments and changed with NR.CONFIG SET */
+typedef struct {
+  long long workers;      // search threads
+  long long queueSize;    // searches waiting for a thread, fixed at load time
+  long long maxQueued;    // searches beyond this many queued are refused, 0 for no limit
+  long long maxQueueAge;  // searches queued for longer than this many ms are dropped, 0 for no limit
+  long long parseCacheMemory;  // bytes of parsed docs kept for hashes without an index, 0 for none
+} NRConfig;
+
+extern NRConfig nrConfig;
+
+/*
+* Read the settings from the module load arguments, e.g.
+*   loadmodule module.so WORKERS 16 QUEUE_SIZE 65536 MAX_QUEUED 1000
+* Settings that aren't given keep their default. Returns REDISMODULE_ERR
+* after logging the reason if an argument is invalid.
+*/
+int NRConfig_Load(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+
+/*
+* nr.config GET <name|*>
+* nr.config SET <name> <value>
+* Read or change a setting at runtime. Setting WORKERS grows or shrinks the
+* search thread pool, queued searches are kept. Lowering PARSE_CACHE_MEMORY
+* evicts cached hashes right away.
+*/
+int NRConfigCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc);
+
+#endif
@@ -0,0 +1,806 @@
+#define _GNU_SOURCE
+#define REDISMODULE_EXPERIMENTAL_API
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "index.h"
+
+#define NR_WRITE_PUT 0
+#define NR_WRITE_DELETE 1
+#define NR_WRITE_CLEAR 2
+
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
+struct nrPendingWrite {
+  struct nrPendingWrite *next;
+  uint64_t seq;  // writes queued before this one
+  int op;
+  uint32_t fieldLen;
+  size_t rawLen;
+  char data[];  // the field then the raw value
+};
+
+/* Indexes by the name of their hash, see NRIndex_HashName */
+static Dict *registry;
+
+const char *NRTextFields[NR_NUM_TEXT_FIELDS] = {"name", "department", "pin", "number"};
+
+static size_t docMemUsage(NRDoc *d) {
+  return sizeof(NRDoc) + d->fieldLen + d->rawLen + 2 + (d->tape ? cJSON_TapeMemUsage(d->tape) : 0);
+}
+
+static NRDoc *newDoc(uint32_t id, const char *field, size_t fieldLen, const char *raw,
+                     size_t rawLen) {
+  NRDoc *d = RedisModule_Alloc(sizeof(NRDoc) + fieldLen + rawLen + 2);
+  d->id = id;
+  d->fieldLen = fieldLen;
+  d->rawLen = rawLen;
+  d->field = (char *)(d + 1);
+  d->raw = d->field + fieldLen + 1;
+  memcpy(d->field, field, fieldLen);
+  d->field[fieldLen] = '\0';
+  memcpy(d->raw, raw, rawLen);
+  d->raw[rawLen] = '\0';
+  d->tape = cJSON_ParseTapeLen(d->raw, rawLen);
+  return d;
+}
+
+static void freeDoc(NRDoc *d) {
+  if (d->tape) cJSON_DeleteTape(d->tape);
+  RedisModule_Free(d);
+}
+
+static void foldTrigram(char *out, const char *s) {
+  for (int i = 0; i < NR_TRIGRAM_LEN; i++) {
+    out[i] = tolower((unsigned char)s[i]);
+  }
+}
+
+static void postingAdd(Dict *postings, const char *key, size_t len, uint32_t id) {
+  Bitmap *bm = Dict_Get(postings, key, len);
+  if (bm == NULL) {
+    bm = NewBitmap();
+    Dict_Set(postings, key, len, bm);
+  }
+  Bitmap_Add(bm, id);
+}
+
+/* Drop the posting list once it's empty so stale values don't pile up */
+static void postingRemove(Dict *postings, const char *key, size_t len, uint32_t id) {
+  Bitmap *bm = Dict_Get(postings, key, len);
+  if (bm != NULL && Bitmap_Remove(bm, id) && Bitmap_Cardinality(bm) == 0) {
+    Dict_Delete(postings, key, len);
+    Bitmap_Free(bm);
+  }
+}
+
+/* Add or remove the id of d to the posting list of every trigram of its text fields */
+static void indexTrigrams(NRIndex *idx, NRDoc *d, int add) {
+  char tri[NR_TRIGRAM_LEN];
+  for (int f = 0; f < NR_NUM_TEXT_FIELDS; f++) {
+    size_t len;
+    const char *text = cJSON_TapeGetString(d->tape, cJSON_KeyHandle(NRTextFields[f]), &len);
+    if (text == NULL) continue;
+
+    for (size_t i = 0; i + NR_TRIGRAM_LEN <= len; i++) {
+      foldTrigram(tri, text + i);
+      if (add) {
+        postingAdd(idx->trigrams, tri, NR_TRIGRAM_LEN, d->id);
+      } else {
+        postingRemove(idx->trigrams, tri, NR_TRIGRAM_LEN, d->id);
+      }
+    }
+  }
+}
+
+/* Keep the string values of the text fields of d in the columns, or remove them */
+static void indexColumns(NRIndex *idx, NRDoc *d, int add) {
+  for (int f = 0; f < NR_NUM_TEXT_FIELDS; f++) {
+    size_t len;
+    const char *text =
+        add ? cJSON_TapeGetString(d->tape, cJSON_KeyHandle(NRTextFields[f]), &len) : NULL;
+    if (text) {
+      Column_Set(idx->text[f], d->id, text, len);
+    } else {
+      Column_Delete(idx->text[f], d->id);
+    }
+  }
+}
+
+static void indexTag(NRTagIndex *tag, NRDoc *d, int add) {
+  size_t len;
+  const char *value = cJSON_TapeGetString(d->tape, cJSON_KeyHandle(tag->name), &len);
+  if (value == NULL) return;
+
+  if (add) {
+    postingAdd(tag->values, value, len, d->id);
+  } else {
+    postingRemove(tag->values, value, len, d->id);
+  }
+}
+
+static void indexSortable(NRSortIndex *sortable, NRDoc *d, int add) {
+  size_t len;
+  const char *value = cJSON_TapeGetString(d->tape, cJSON_KeyHandle(sortable->name), &len);
+  if (value == NULL) {
+    if (add) {
+      Bitmap_Add(sortable->missing, d->id);
+    } else {
+      Bitmap_Remove(sortable->missing, d->id);
+    }
+  } else if (add) {
+    SkipList_Insert(sortable->order, value, len, d->id);
+  } else {
+    SkipList_Delete(sortable->order, value, len, d->id);
+  }
+}
+
+/* Add or remove d from all the secondary indexes */
+static void indexDoc(NRIndex *idx, NRDoc *d, int add) {
+  if (d->tape == NULL) return;
+
+  indexTrigrams(idx, d, add);
+  indexColumns(idx, d, add);
+  for (int i = 0; i < idx->numTags; i++) {
+    indexTag(&idx->tags[i], d, add);
+  }
+  for (int i = 0; i < idx->numSortables; i++) {
+    indexSortable(&idx->sortables[i], d, add);
+  }
+}
+
+static char *copyName(const char *field, size_t len) {
+  char *name = RedisModule_Alloc(len + 1);
+  memcpy(name, field, len);
+  name[len] = '\0';
+  return name;
+}
+
+static size_t postingsMemUsage(Dict *postings) {
+  size_t mem = Dict_MemUsage(postings);
+  DictIterator it = Dict_Iterate(postings);
+  DictEntry *e;
+  while ((e = DictIterator_Next(&it))) {
+    mem += Bitmap_MemUsage(e->val);
+  }
+  return mem;
+}
+
+static void freeBitmap(void *bm) {
+  Bitmap_Free(bm);
+}
+
+static uint32_t allocDocId(NRIndex *idx) {
+  uint32_t id;
+  if (Vector_Pop(idx->freeIds, &id)) {
+    return id;
+  }
+  if (idx->top == idx->cap) {
+    idx->cap = idx->cap ? idx->cap * 2 : 16;
+    idx->docs = RedisModule_Realloc(idx->docs, idx->cap * sizeof(NRDoc *));
+  }
+  return idx->top++;
+}
+
+NRIndex *NewNRIndex() {
+  NRIndex *idx = RedisModule_Calloc(1, sizeof(NRIndex));
+  idx->freeIds = NewVector(uint32_t, 0);
+  idx->fields = NewDict(16);
+  idx->trigrams = NewDict(256);
+  for (int f = 0; f < NR_NUM_TEXT_FIELDS; f++) {
+    idx->text[f] = NewColumn();
+  }
+  idx->refcount = 1;
+  idx->mem = sizeof(NRIndex);
+
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+  // glibc prefers readers by default, back to back searches would keep writes out for good
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&idx->lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  pthread_mutex_init(&idx->pendingLock, NULL);
+  return idx;
+}
+
+int NRIndex_Put(NRIndex *idx, const char *field, size_t fieldLen, const char *raw, size_t rawLen) {
+  NRDoc *old = Dict_Get(idx->fields, field, fieldLen);
+  uint32_t id = old ? old->id : allocDocId(idx);
+
+  // the id is reused on update, so the old postings must go first
+  if (old) indexDoc(idx, old, 0);
+
+  NRDoc *d = newDoc(id, field, fieldLen, raw, rawLen);
+  idx->docs[id] = d;
+  Dict_Set(idx->fields, field, fieldLen, d);
+  indexDoc(idx, d, 1);
+  idx->mem += docMemUsage(d);
+
+  if (old) {
+    idx->mem -= docMemUsage(old);
+    freeDoc(old);
+    return 0;
+  }
+  idx->numDocs++;
+  return 1;
+}
+
+int NRIndex_Delete(NRIndex *idx, const char *field, size_t fieldLen) {
+  NRDoc *d = Dict_Delete(idx->fields, field, fieldLen);
+  if (!d) return 0;
+
+  indexDoc(idx, d, 0);
+  idx->docs[d->id] = NULL;
+  Vector_Push(idx->freeIds, d->id);
+  idx->numDocs--;
+  idx->mem -= docMemUsage(d);
+  freeDoc(d);
+  return 1;
+}
+
+void NRIndex_Clear(NRIndex *idx) {
+  for (uint32_t i = 0; i < idx->top; i++) {
+    if (idx->docs[i]) freeDoc(idx->docs[i]);
+  }
+  RedisModule_Free(idx->docs);
+  idx->docs = NULL;
+  idx->cap = idx->top = idx->numDocs = 0;
+  idx->freeIds->top = 0;
+  Dict_Free(idx->fields, NULL);
+  idx->fields = NewDict(16);
+  Dict_Free(idx->trigrams, freeBitmap);
+  idx->trigrams = NewDict(256);
+  for (int f = 0; f < NR_NUM_TEXT_FIELDS; f++) {
+    Column_Free(idx->text[f]);
+    idx->text[f] = NewColumn();
+  }
+  // the TAG fields are part of the schema and stay
+  for (int i = 0; i < idx->numTags; i++) {
+    Dict_Free(idx->tags[i].values, freeBitmap);
+    idx->tags[i].values = NewDict(16);
+  }
+  for (int i = 0; i < idx->numSortables; i++) {
+    SkipList_Free(idx->sortables[i].order);
+    Bitmap_Free(idx->sortables[i].missing);
+    idx->sortables[i].order = NewSkipList();
+    idx->sortables[i].missing = NewBitmap();
+  }
+  idx->mem = sizeof(NRIndex);
+}
+
+void NRIndex_AddTag(NRIndex *idx, const char *field, size_t len) {
+  for (int i = 0; i < idx->numTags; i++) {
+    if (strlen(idx->tags[i].name) == len && !memcmp(idx->tags[i].name, field, len)) return;
+  }
+
+  idx->tags = RedisModule_Realloc(idx->tags, (idx->numTags + 1) * sizeof(NRTagIndex));
+  NRTagIndex *tag = &idx->tags[idx->numTags++];
+  tag->name = copyName(field, len);
+  tag->values = NewDict(16);
+
+  for (uint32_t i = 0; i < idx->top; i++) {
+    if (idx->docs[i] && idx->docs[i]->tape) indexTag(tag, idx->docs[i], 1);
+  }
+}
+
+NRTagIndex *NRIndex_GetTag(NRIndex *idx, const char *field) {
+  for (int i = 0; i < idx->numTags; i++) {
+    if (!strcmp(idx->tags[i].name, field)) return &idx->tags[i];
+  }
+  return NULL;
+}
+
+void NRIndex_AddSortable(NRIndex *idx, const char *field, size_t len) {
+  for (int i = 0; i < idx->numSortables; i++) {
+    if (strlen(idx->sortables[i].name) == len && !memcmp(idx->sortables[i].name, field, len)) {
+      return;
+    }
+  }
+
+  idx->sortables =
+      RedisModule_Realloc(idx->sortables, (idx->numSortables + 1) * sizeof(NRSortIndex));
+  NRSortIndex *sortable = &idx->sortables[idx->numSortables++];
+  sortable->name = copyName(field, len);
+  sortable->order = NewSkipList();
+  sortable->missing = NewBitmap();
+
+  for (uint32_t i = 0; i < idx->top; i++) {
+    if (idx->docs[i] && idx->docs[i]->tape) indexSortable(sortable, idx->docs[i], 1);
+  }
+}
+
+NRSortIndex *NRIndex_GetSortable(NRIndex *idx, const char *field) {
+  for (int i = 0; i < idx->numSortables; i++) {
+    if (!strcmp(idx->sortables[i].name, field)) return &idx->sortables[i];
+  }
+  return NULL;
+}
+
+Bitmap *NRTagIndex_Docs(NRTagIndex *tag, const char *value, size_t len) {
+  return Dict_Get(tag->values, value, len);
+}
+
+static int compareCardinality(const void *a, const void *b) {
+  uint64_t ca = Bitmap_Cardinality(*(Bitmap **)a), cb = Bitmap_Cardinality(*(Bitmap **)b);
+  return (ca > cb) - (ca < cb);
+}
+
+Bitmap *NRIndex_TextCandidates(NRIndex *idx, const char *query, size_t len) {
+  if (len < NR_TRIGRAM_LEN) return NULL;
+
+  size_t n = len - NR_TRIGRAM_LEN + 1;
+  Bitmap **lists = RedisModule_Alloc(n * sizeof(Bitmap *));
+  char tri[NR_TRIGRAM_LEN];
+  for (size_t i = 0; i < n; i++) {
+    foldTrigram(tri, query + i);
+    lists[i] = Dict_Get(idx->trigrams, tri, NR_TRIGRAM_LEN);
+    // a trigram no doc has, nothing can match
+    if (lists[i] == NULL) {
+      RedisModule_Free(lists);
+      return NewBitmap();
+    }
+  }
+
+  // intersect starting from the shortest list so the working set only shrinks
+  qsort(lists, n, sizeof(Bitmap *), compareCardinality);
+  Bitmap *res = Bitmap_Copy(lists[0]);
+  for (size_t i = 1; i < n && Bitmap_Cardinality(res) > 0; i++) {
+    if (lists[i] != lists[i - 1]) Bitmap_AndInPlace(res, lists[i]);
+  }
+  RedisModule_Free(lists);
+  return res;
+}
+
+Bitmap *NRIndex_TextMatches(NRIndex *idx, const char *query, size_t len) {
+  Bitmap *res = NewBitmap();
+  for (int f = 0; f < NR_NUM_TEXT_FIELDS; f++) {
+    Column_FindCase(idx->text[f], query, len, res);
+  }
+  return res;
+}
+
+Column *NRIndex_GetColumn(NRIndex *idx, const char *field) {
+  for (int f = 0; f < NR_NUM_TEXT_FIELDS; f++) {
+    if (!strcmp(NRTextFields[f], field)) return idx->text[f];
+  }
+  return NULL;
+}
+
+void NRIndex_QueueHashField(NRIndex *idx, RedisModuleCtx *ctx, RedisModuleKey *key,
+                            const char *field, size_t len) {
+  RedisModuleString *f = RedisModule_CreateString(ctx, field, len);
+  RedisModuleString *v = NULL;
+  if (RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_HASH) {
+    RedisModule_HashGet(key, REDISMODULE_HASH_NONE, f, &v, NULL);
+  }
+  if (v) {
+    size_t vlen;
+    const char *value = RedisModule_StringPtrLen(v, &vlen);
+    NRIndex_QueuePut(idx, field, len, value, vlen);
+    RedisModule_FreeString(ctx, v);
+  } else {
+    NRIndex_QueueDelete(idx, field, len);
+  }
+  RedisModule_FreeString(ctx, f);
+}
+
+void NRIndex_LoadHashReply(NRIndex *idx, RedisModuleCallReply *reply) {
+  size_t n = RedisModule_CallReplyLength(reply);
+  size_t flen, vlen;
+  for (size_t i = 0; i + 1 < n; i += 2) {
+    const char *field = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply, i),
+                                                       &flen);
+    const char *value =
+        RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply, i + 1), &vlen);
+    NRIndex_Put(idx, field, flen, value, vlen);
+  }
+}
+
+static size_t pendingWriteSize(NRPendingWrite *w) {
+  return sizeof(NRPendingWrite) + w->fieldLen + w->rawLen;
+}
+
+static void queueWrite(NRIndex *idx, int op, const char *field, size_t fieldLen, const char *raw,
+                       size_t rawLen) {
+  pthread_mutex_lock(&idx->pendingLock);
+  // stale docs are read again whole, writes until then would be dropped
+  if (idx->stale) {
+    pthread_mutex_unlock(&idx->pendingLock);
+    return;
+  }
+  NRPendingWrite *w = RedisModule_Alloc(sizeof(NRPendingWrite) + fieldLen + rawLen);
+  w->next = NULL;
+  w->seq = idx->queued;
+  w->op = op;
+  w->fieldLen = fieldLen;
+  w->rawLen = rawLen;
+  memcpy(w->data, field, fieldLen);
+  memcpy(w->data + fieldLen, raw, rawLen);
+
+  if (idx->pendingTail) idx->pendingTail->next = w;
+  else idx->pending = w;
+  idx->pendingTail = w;
+  idx->queued++;
+  __atomic_add_fetch(&idx->pendingMem, pendingWriteSize(w), __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&idx->pendingLock);
+}
+
+void NRIndex_QueuePut(NRIndex *idx, const char *field, size_t fieldLen, const char *raw,
+                      size_t rawLen) {
+  queueWrite(idx, NR_WRITE_PUT, field, fieldLen, raw, rawLen);
+}
+
+void NRIndex_QueueDelete(NRIndex *idx, const char *field, size_t fieldLen) {
+  queueWrite(idx, NR_WRITE_DELETE, field, fieldLen, NULL, 0);
+}
+
+void NRIndex_QueueClear(NRIndex *idx) {
+  queueWrite(idx, NR_WRITE_CLEAR, NULL, 0, NULL, 0);
+}
+
+/* Apply the queued writes until upTo of them were applied, those dropped by
+ * NRIndex_MarkStale count as applied. The caller holds the write lock */
+static void applyPending(NRIndex *idx, uint64_t upTo) {
+  for (;;) {
+    pthread_mutex_lock(&idx->pendingLock);
+    NRPendingWrite *w = idx->pending;
+    if (w == NULL || w->seq >= upTo) {
+      pthread_mutex_unlock(&idx->pendingLock);
+      break;
+    }
+    idx->pending = w->next;
+    if (idx->pending == NULL) idx->pendingTail = NULL;
+    __atomic_sub_fetch(&idx->pendingMem, pendingWriteSize(w), __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&idx->pendingLock);
+
+    if (w->op == NR_WRITE_PUT) {
+      NRIndex_Put(idx, w->data, w->fieldLen, w->data + w->fieldLen, w->rawLen);
+    } else if (w->op == NR_WRITE_DELETE) {
+      NRIndex_Delete(idx, w->data, w->fieldLen);
+    } else {
+      NRIndex_Clear(idx);
+    }
+    RedisModule_Free(w);
+  }
+  if (idx->applied < upTo) __atomic_store_n(&idx->applied, upTo, __ATOMIC_RELEASE);
+}
+
+static uint64_t queuedWrites(NRIndex *idx) {
+  pthread_mutex_lock(&idx->pendingLock);
+  uint64_t queued = idx->queued;
+  pthread_mutex_unlock(&idx->pendingLock);
+  return queued;
+}
+
+/* Tell if the docs are stale and, if takeOver, leave reading them again to the caller */
+static int checkStale(NRIndex *idx, int takeOver) {
+  pthread_mutex_lock(&idx->pendingLock);
+  int stale = idx->stale;
+  if (takeOver) idx->stale = 0;
+  pthread_mutex_unlock(&idx->pendingLock);
+  return stale;
+}
+
+static void freePending(NRIndex *idx) {
+  while (idx->pending) {
+    NRPendingWrite *w = idx->pending;
+    idx->pending = w->next;
+    RedisModule_Free(w);
+  }
+  idx->pendingTail = NULL;
+  __atomic_store_n(&idx->pendingMem, 0, __ATOMIC_RELAXED);
+}
+
+void NRIndex_TryApply(NRIndex *idx) {
+  if (pthread_rwlock_trywrlock(&idx->lock) != 0) return;
+  applyPending(idx, queuedWrites(idx));
+  NRIndex_Unlock(idx);
+}
+
+void NRIndex_Mark(NRIndex *idx, RedisModuleCtx *ctx, RedisModuleString *hashKey,
+                  NRIndexMark *mark) {
+  RedisModuleKey *key = RedisModule_OpenKey(ctx, hashKey, REDISMODULE_READ);
+  mark->numFields =
+      RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_HASH ? RedisModule_ValueLength(key) : 0;
+  RedisModule_CloseKey(key);
+  mark->writes = queuedWrites(idx);
+}
+
+int NRIndex_Apply(NRIndex *idx, const NRIndexMark *mark) {
+  uint64_t queued = queuedWrites(idx);
+  int same = 1;
+
+  if (__atomic_load_n(&idx->applied, __ATOMIC_ACQUIRE) < queued) {
+    NRIndex_WriteLock(idx);
+    // the docs can only be told apart from the hash where the mark was taken
+    if (mark && idx->applied <= mark->writes) {
+      applyPending(idx, mark->writes);
+      same = idx->numDocs == mark->numFields;
+    }
+    applyPending(idx, queued);
+    NRIndex_UpdateMemUsage(idx);
+    NRIndex_Unlock(idx);
+  } else if (mark) {
+    NRIndex_ReadLock(idx);
+    same = idx->applied != mark->writes || idx->numDocs == mark->numFields;
+    NRIndex_Unlock(idx);
+  }
+  if (!same) NRIndex_MarkStale(idx);
+  return !checkStale(idx, 0);
+}
+
+void NRIndex_MarkStale(NRIndex *idx) {
+  pthread_mutex_lock(&idx->pendingLock);
+  freePending(idx);
+  idx->stale = 1;
+  pthread_mutex_unlock(&idx->pendingLock);
+}
+
+void NRIndex_Rebuild(NRIndex *idx, RedisModuleCtx *ctx, RedisModuleString *hashKey) {
+  char cursor[32] = "0";
+  size_t len;
+
+  NRIndex_WriteLock(idx);
+  // another search may have read the hash while this one waited for the lock. From now on the
+  // main thread queues its writes again, each is applied before the chunks read after it
+  RedisModule_ThreadSafeContextLock(ctx);
+  int stale = checkStale(idx, 1);
+  RedisModule_ThreadSafeContextUnlock(ctx);
+  if (!stale) {
+    NRIndex_Unlock(idx);
+    return;
+  }
+
+  NRIndex_Clear(idx);
+  do {
+    RedisModule_ThreadSafeContextLock(ctx);
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, "HSCAN", "sccl", hashKey, cursor, "COUNT",
+                                                   (long long)NR_SCAN_CHUNK_SIZE);
+    uint64_t queued = queuedWrites(idx);
+    RedisModule_ThreadSafeContextUnlock(ctx);
+
+    // the key no longer holds a hash, a later search tries again
+    if (reply == NULL || RedisModule_CallReplyType(reply) != REDISMODULE_REPLY_ARRAY) {
+      if (reply) RedisModule_FreeCallReply(reply);
+      NRIndex_Clear(idx);
+      NRIndex_MarkStale(idx);
+      break;
+    }
+
+    const char *next = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply, 0),
+                                                      &len);
+    len = min(len, sizeof(cursor) - 1);
+    memcpy(cursor, next, len);
+    cursor[len] = '\0';
+    applyPending(idx, queued);
+    // a field HSCAN returns twice is only replaced
+    NRIndex_LoadHashReply(idx, RedisModule_CallReplyArrayElement(reply, 1));
+    RedisModule_FreeCallReply(reply);
+  } while (strcmp(cursor, "0") != 0);
+
+  NRIndex_UpdateMemUsage(idx);
+  NRIndex_Unlock(idx);
+}
+
+static void freeIndex(NRIndex *idx) {
+  NRIndex_Clear(idx);
+  freePending(idx);
+  Vector_Free(idx->freeIds);
+  Dict_Free(idx->fields, NULL);
+  Dict_Free(idx->trigrams, freeBitmap);
+  for (int f = 0; f < NR_NUM_TEXT_FIELDS; f++) {
+    Column_Free(idx->text[f]);
+  }
+  for (int i = 0; i < idx->numTags; i++) {
+    Dict_Free(idx->tags[i].values, freeBitmap);
+    RedisModule_Free(idx->tags[i].name);
+  }
+  RedisModule_Free(idx->tags);
+  for (int i = 0; i < idx->numSortables; i++) {
+    SkipList_Free(idx->sortables[i].order);
+    Bitmap_Free(idx->sortables[i].missing);
+    RedisModule_Free(idx->sortables[i].name);
+  }
+  RedisModule_Free(idx->sortables);
+  pthread_rwlock_destroy(&idx->lock);
+  pthread_mutex_destroy(&idx->pendingLock);
+  RedisModule_Free(idx);
+}
+
+void NRIndex_Retain(NRIndex *idx) {
+  __sync_add_and_fetch(&idx->refcount, 1);
+}
+
+void NRIndex_Release(NRIndex *idx) {
+  if (__sync_sub_and_fetch(&idx->refcount, 1) == 0) {
+    freeIndex(idx);
+  }
+}
+
+char *NRIndex_HashName(RedisModuleCtx *ctx, RedisModuleString *hashKey, char *buf, size_t *len) {
+  size_t klen;
+  const char *key = RedisModule_StringPtrLen(hashKey, &klen);
+  int db = RedisModule_GetSelectedDb(ctx);
+  *len = sizeof(db) + klen;
+  char *name = *len <= NR_NAME_BUF_SIZE ? buf : RedisModule_Alloc(*len);
+  memcpy(name, &db, sizeof(db));
+  memcpy(name + sizeof(db), key, klen);
+  return name;
+}
+
+int NRIndex_NameDb(const char *name) {
+  int db;
+  memcpy(&db, name, sizeof(db));
+  return db;
+}
+
+NRIndex *NRIndex_Get(RedisModuleCtx *ctx, RedisModuleString *hashKey) {
+  if (Dict_Size(registry) == 0) return NULL;
+
+  char buf[NR_NAME_BUF_SIZE];
+  size_t len;
+  char *name = NRIndex_HashName(ctx, hashKey, buf, &len);
+  NRIndex *idx = Dict_Get(registry, name, len);
+  if (name != buf) RedisModule_Free(name);
+  return idx;
+}
+
+/* Register idx by name, releasing the index it replaces */
+static void registerIndex(const char *name, size_t len, NRIndex *idx) {
+  NRIndex *old = Dict_Get(registry, name, len);
+  Dict_Set(registry, name, len, idx);
+  if (old) NRIndex_Release(old);
+}
+
+void NRIndex_Set(RedisModuleCtx *ctx, RedisModuleString *hashKey, NRIndex *idx) {
+  char buf[NR_NAME_BUF_SIZE];
+  size_t len;
+  char *name = NRIndex_HashName(ctx, hashKey, buf, &len);
+  registerIndex(name, len, idx);
+  if (name != buf) RedisModule_Free(name);
+}
+
+void NRIndex_FlushDb(int db) {
+  Dict *kept = NewDict(16);
+  DictIterator it = Dict_Iterate(registry);
+  DictEntry *e;
+  while ((e = DictIterator_Next(&it))) {
+    if (db == -1 || NRIndex_NameDb(e->key) == db) {
+      NRIndex_Release(e->val);
+    } else {
+      Dict_Set(kept, e->key, e->len, e->val);
+    }
+  }
+  Dict_Free(registry, NULL);
+  registry = kept;
+}
+
+void NRIndex_SwapDb(int a, int b) {
+  Dict *swapped = NewDict(16);
+  DictIterator it = Dict_Iterate(registry);
+  DictEntry *e;
+  while ((e = DictIterator_Next(&it))) {
+    int db = NRIndex_NameDb(e->key);
+    if (db == a || db == b) {
+      char buf[NR_NAME_BUF_SIZE];
+      char *name = e->len <= NR_NAME_BUF_SIZE ? buf : RedisModule_Alloc(e->len);
+      db = db == a ? b : a;
+      memcpy(name, &db, sizeof(db));
+      memcpy(name + sizeof(db), e->key + sizeof(db), e->len - sizeof(db));
+      Dict_Set(swapped, name, e->len, e->val);
+      if (name != buf) RedisModule_Free(name);
+    } else {
+      Dict_Set(swapped, e->key, e->len, e->val);
+    }
+  }
+  Dict_Free(registry, NULL);
+  registry = swapped;
+}
+
+static void loadSchemaFields(RedisModuleIO *rdb, NRIndex *idx,
+                             void (*add)(NRIndex *, const char *, size_t)) {
+  size_t len;
+  uint64_t n = RedisModule_LoadUnsigned(rdb);
+  while (n--) {
+    char *field = RedisModule_LoadStringBuffer(rdb, &len);
+    add(idx, field, len);
+    RedisModule_Free(field);
+  }
+}
+
+/* The docs are in the hashes already, only what NR.INDEX was given is saved */
+static void indexAuxSave(RedisModuleIO *rdb, int when) {
+  RedisModule_SaveUnsigned(rdb, Dict_Size(registry));
+  DictIterator it = Dict_Iterate(registry);
+  DictEntry *e;
+  while ((e = DictIterator_Next(&it))) {
+    NRIndex *idx = e->val;
+    RedisModule_SaveStringBuffer(rdb, e->key, e->len);
+    RedisModule_SaveUnsigned(rdb, idx->numTags);
+    for (int i = 0; i < idx->numTags; i++) {
+      RedisModule_SaveStringBuffer(rdb, idx->tags[i].name, strlen(idx->tags[i].name));
+    }
+    RedisModule_SaveUnsigned(rdb, idx->numSortables);
+    for (int i = 0; i < idx->numSortables; i++) {
+      RedisModule_SaveStringBuffer(rdb, idx->sortables[i].name, strlen(idx->sortables[i].name));
+    }
+  }
+}
+
+/* The indexes come back empty and stale, their first search reads the hash, see NRIndex_Rebuild */
+static int indexAuxLoad(RedisModuleIO *rdb, int encver, int when) {
+  if (encver != NRINDEX_ENCVER) {
+    return REDISMODULE_ERR;
+  }
+  size_t len;
+  uint64_t n = RedisModule_LoadUnsigned(rdb);
+  while (n--) {
+    char *name = RedisModule_LoadStringBuffer(rdb, &len);
+    NRIndex *idx = NewNRIndex();
+    loadSchemaFields(rdb, idx, NRIndex_AddTag);
+    loadSchemaFields(rdb, idx, NRIndex_AddSortable);
+    NRIndex_MarkStale(idx);
+    registerIndex(name, len, idx);
+    RedisModule_Free(name);
+  }
+  return REDISMODULE_OK;
+}
+
+void NRIndex_UpdateMemUsage(NRIndex *idx) {
+  size_t mem = idx->mem + idx->cap * sizeof(NRDoc *) + Dict_MemUsage(idx->fields) +
+               postingsMemUsage(idx->trigrams);
+  for (int f = 0; f < NR_NUM_TEXT_FIELDS; f++) {
+    mem += Column_MemUsage(idx->text[f]);
+  }
+  for (int i = 0; i < idx->numTags; i++) {
+    mem += sizeof(NRTagIndex) + strlen(idx->tags[i].name) + 1 +
+           postingsMemUsage(idx->tags[i].values);
+  }
+  for (int i = 0; i < idx->numSortables; i++) {
+    mem += sizeof(NRSortIndex) + strlen(idx->sortables[i].name) + 1 +
+           SkipList_MemUsage(idx->sortables[i].order) +
+           Bitmap_MemUsage(idx->sortables[i].missing);
+  }
+  __atomic_store_n(&idx->memUsage, mem, __ATOMIC_RELAXED);
+}
+
+size_t NRIndex_MemUsage(const NRIndex *idx) {
+  return __atomic_load_n(&idx->memUsage, __ATOMIC_RELAXED) +
+         __atomic_load_n(&idx->pendingMem, __ATOMIC_RELAXED);
+}
+
+static int configIs(RedisModuleCtx *ctx, const char *name, const char *value) {
+  RedisModuleCallReply *reply = RedisModule_Call(ctx, "CONFIG", "cc", "GET", name);
+  int is = 0;
+  if (reply && RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ARRAY &&
+      RedisModule_CallReplyLength(reply) == 2) {
+    size_t len;
+    const char *v = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply, 1),
+                                                   &len);
+    is = len == strlen(value) && strncasecmp(v, value, len) == 0;
+  }
+  if (reply) RedisModule_FreeCallReply(reply);
+  return is;
+}
+
+int NRIndex_RegisterType(RedisModuleCtx *ctx) {
+  RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
+                               .aux_load = indexAuxLoad,
+                               .aux_save = indexAuxSave,
+                               .aux_save_triggers = REDISMODULE_AUX_AFTER_RDB};
+
+  registry = NewDict(16);
+  // no key ever holds this type, it only carries the schemas in the RDB
+  if (RedisModule_CreateDataType(ctx, "nr-search", NRINDEX_ENCVER, &tm) == NULL) {
+    return REDISMODULE_ERR;
+  }
+  // a restart loading a plain AOF has no aux data to read the schemas from
+  if (configIs(ctx, "appendonly", "yes") && !configIs(ctx, "aof-use-rdb-preamble", "yes")) {
+    RedisModule_Log(ctx, "warning",
+                    "appendonly is on without aof-use-rdb-preamble, NR.INDEX schemas are only "
+                    "saved in RDB files and restarting from the AOF drops every index");
+  }
+  return REDISMODULE_OK;
+}
@@ -0,0 +1,245 @@
+#ifndef __NR_INDEX_H__
+#define __NR_INDEX_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "../redismodule.h"
+#include "../rmutil/vector.h"
+#include "../rmutil/dict.h"
+#include "../rmutil/bitmap.h"
+#include "../rmutil/skiplist.h"
+#include "../rmutil/column.h"
+#include "../rmutil/cJSON.h"
+
+/* Version of the index schemas saved in the RDB, see NRIndex_RegisterType */
+#define NRINDEX_ENCVER 4
+
+/* Names of registered hashes fitting in this many bytes are built on the stack */
+#define NR_NAME_BUF_SIZE 256
+
+/* Number of hash fields fetched per HSCAN call while the GIL is held */
+#define NR_SCAN_CHUNK_SIZE 1000
+
+/* Document fields the free text query is matched against */
+#define NR_NUM_TEXT_FIELDS 4
+extern const char *NRTextFields[NR_NUM_TEXT_FIELDS];
+
+/* Queries shorter than this can't use the trigram index */
+#define NR_TRIGRAM_LEN 3
+
+/*
+* A single hash field kept pre-parsed. field and raw point into the same
+* allocation as the struct, raw is NULL terminated so cJSON can parse it in
+* place and the string values of the tape reference it without copying.
+*/
+typedef struct {
+  uint32_t id;
+  uint32_t fieldLen;
+  size_t rawLen;
+  char *field;
+  char *raw;
+  cJSON_Tape *tape;  // NULL if raw is not valid JSON, such docs never match
+} NRDoc;
+
+/* Equality index of a TAG field, only string values are indexed */
+typedef struct {
+  char *name;
+  Dict *values;  // field value -> Bitmap of doc ids
+} NRTagIndex;
+
+/*
+* Order of the docs by a SORTABLE field. Docs whose value is a string are in
+* the skiplist, keyed by the value inside their parsed JSON, the others are
+* in missing as they sort last either way.
+*/
+typedef struct {
+  char *name;
+  SkipList *order;
+  Bitmap *missing;
+} NRSortIndex;
+
+/* A write to the docs of an index queued by the main thread, see NRIndex_QueuePut */
+typedef struct nrPendingWrite NRPendingWrite;
+
+/*
+* Pre-parsed documents of one hash. The main thread never waits on the lock:
+* it queues its writes, which the next search applies under the write lock,
+* or applies them right away when no search is reading the docs. Writes it
+* can't track by field mark the docs stale instead, and the next search reads
+* the hash again. Search workers hold the read lock while scanning. The lock
+* prefers writers, so a search applying writes only waits for the searches
+* already running. The refcount keeps the index alive for workers when it is
+* replaced or dropped while a search is running.
+*/
+typedef struct {
+  NRDoc **docs;            // doc slots by id, NULL for free slots
+  uint32_t cap;
+  uint32_t top;            // one past the highest id handed out so far
+  uint32_t numDocs;
+  Vector *freeIds;         // ids of deleted docs, reused by new ones
+  Dict *fields;            // hash field -> NRDoc
+  Dict *trigrams;          // lower cased trigram of the text fields -> Bitmap of doc ids
+  Column *text[NR_NUM_TEXT_FIELDS];  // string values of the text fields by doc id
+  NRTagIndex *tags;        // opt-in TAG fields, see NRIndex_AddTag
+  int numTags;
+  NRSortIndex *sortables;  // opt-in SORTABLE fields, see NRIndex_AddSortable
+  int numSortables;
+  size_t mem;
+  size_t memUsage;         // see NRIndex_UpdateMemUsage
+  int refcount;
+  pthread_rwlock_t lock;
+  pthread_mutex_t pendingLock;
+  NRPendingWrite *pending, *pendingTail;  // queued writes not applied yet, oldest first
+  uint64_t queued;         // writes queued so far
+  uint64_t applied;        // writes applied so far
+  size_t pendingMem;
+  int stale;               // see NRIndex_MarkStale, under pendingLock
+} NRIndex;
+
+/* Where a search starts: the writes queued before it and the length of the hash then */
+typedef struct {
+  uint64_t writes;
+  size_t numFields;
+} NRIndexMark;
+
+NRIndex *NewNRIndex();
+
+/* Add or replace the document stored under field. The caller must hold the
+ * write lock. Returns 1 if the field is new, 0 if it was updated */
+int NRIndex_Put(NRIndex *idx, const char *field, size_t fieldLen, const char *raw, size_t rawLen);
+
+/* Remove the document stored under field. The caller must hold the write lock.
+ * Returns 1 if the field was removed, 0 if it was not indexed */
+int NRIndex_Delete(NRIndex *idx, const char *field, size_t fieldLen);
+
+/* Remove all documents. The caller must hold the write lock */
+void NRIndex_Clear(NRIndex *idx);
+
+/* Index the string values of field as tags, including those of the docs
+ * already in the index. Does nothing if field is already a tag. The caller
+ * must hold the write lock */
+void NRIndex_AddTag(NRIndex *idx, const char *field, size_t len);
+
+/* Return the tag index of field, or NULL if field is not a TAG field */
+NRTagIndex *NRIndex_GetTag(NRIndex *idx, const char *field);
+
+/* Return the ids of the docs whose tag is value, or NULL if there are none.
+ * The bitmap is owned by the index */
+Bitmap *NRTagIndex_Docs(NRTagIndex *tag, const char *value, size_t len);
+
+/* Keep the docs ordered by field, including those already in the index.
+ * Does nothing if field is already sortable. The caller must hold the write
+ * lock */
+void NRIndex_AddSortable(NRIndex *idx, const char *field, size_t len);
+
+/* Return the order index of field, or NULL if field is not a SORTABLE field */
+NRSortIndex *NRIndex_GetSortable(NRIndex *idx, const char *field);
+
+/* Return the ids of the docs whose text fields contain every trigram of
+ * query, a superset of the docs matching it that the caller must verify and
+ * free. Returns NULL if the query is too short to narrow the search, in which
+ * case every doc is a candidate. The caller must hold the read lock */
+Bitmap *NRIndex_TextCandidates(NRIndex *idx, const char *query, size_t len);
+
+/* Queue a write of the doc stored under field, or of its removal if the hash
+ * open in key has no such field anymore. Must be called with the GIL held */
+void NRIndex_QueueHashField(NRIndex *idx, RedisModuleCtx *ctx, RedisModuleKey *key,
+                            const char *field, size_t len);
+
+/* Return the ids of the docs whose text fields contain query, ignoring case.
+ * Every text column is scanned whole, which beats checking the docs one by
+ * one once a good part of them are candidates. The caller must hold the read
+ * lock and free the result */
+Bitmap *NRIndex_TextMatches(NRIndex *idx, const char *query, size_t len);
+
+/* Return the column of field, or NULL if field is not a text field */
+Column *NRIndex_GetColumn(NRIndex *idx, const char *field);
+
+/* Put the field/value pairs of an HGETALL or HSCAN reply. The caller must hold the write lock */
+void NRIndex_LoadHashReply(NRIndex *idx, RedisModuleCallReply *reply);
+
+/* Queue the put of a copy of raw under field, applied by NRIndex_Apply or
+ * NRIndex_TryApply. The queue functions must be called with the GIL held */
+void NRIndex_QueuePut(NRIndex *idx, const char *field, size_t fieldLen, const char *raw,
+                      size_t rawLen);
+void NRIndex_QueueDelete(NRIndex *idx, const char *field, size_t fieldLen);
+void NRIndex_QueueClear(NRIndex *idx);
+
+/* Apply the queued writes unless a search is reading the docs, never waits.
+ * Called by the main thread once it queued writes */
+void NRIndex_TryApply(NRIndex *idx);
+
+/* Record where a search of hashKey starts. Must be called with the GIL held */
+void NRIndex_Mark(NRIndex *idx, RedisModuleCtx *ctx, RedisModuleString *hashKey,
+                  NRIndexMark *mark);
+
+/* Apply the queued writes, waiting for the searches reading the docs.
+ * Returns 0 if the docs are stale, which they become when they were not as
+ * many as the fields of the hash at mark once the writes queued before it were
+ * applied. Untracked writes mark them stale already, so this only catches
+ * writes sending no notification at all. mark may be NULL */
+int NRIndex_Apply(NRIndex *idx, const NRIndexMark *mark);
+
+/* Drop the queued writes and stop queuing new ones, the docs missed a write
+ * that can't be tracked by field. The next search reads the hash again with
+ * NRIndex_Rebuild. Must be called with the GIL held or by NRIndex_Apply */
+void NRIndex_MarkStale(NRIndex *idx);
+
+/* Read hashKey again into the docs if they are stale, with HSCAN, only taking
+ * the GIL while a chunk is fetched, like ParseCache_Fill. The write lock is
+ * held throughout, searches wait for the docs to be whole while the main
+ * thread goes on queuing writes, applied in turn with the chunks */
+void NRIndex_Rebuild(NRIndex *idx, RedisModuleCtx *ctx, RedisModuleString *hashKey);
+
+#define NRIndex_ReadLock(idx) pthread_rwlock_rdlock(&(idx)->lock)
+#define NRIndex_WriteLock(idx) pthread_rwlock_wrlock(&(idx)->lock)
+#define NRIndex_Unlock(idx) pthread_rwlock_unlock(&(idx)->lock)
+
+/* Measure the bytes used by the docs and secondary indexes, which takes a walk
+ * over the postings. The caller must hold the write lock. NRIndex_Apply does
+ * it once it applied writes */
+void NRIndex_UpdateMemUsage(NRIndex *idx);
+
+/* Bytes used by the index as last measured, plus the queued writes */
+size_t NRIndex_MemUsage(const NRIndex *idx);
+
+/* Take a reference to the index. Must be called with the GIL held */
+void NRIndex_Retain(NRIndex *idx);
+
+/* Drop a reference, freeing the index when it was the last one */
+void NRIndex_Release(NRIndex *idx);
+
+/* Build the name hashKey is registered under in buf, or in an allocation the
+ * caller frees if it doesn't fit. It is the selected db and the key name, as
+ * the same name may be a hash in several dbs */
+char *NRIndex_HashName(RedisModuleCtx *ctx, RedisModuleString *hashKey, char *buf, size_t *len);
+
+/* Return the db of a name built by NRIndex_HashName */
+int NRIndex_NameDb(const char *name);
+
+/* Return the index of hashKey, or NULL if the hash is not indexed. The
+ * returned pointer is owned by the registry and only valid while the GIL is
+ * held, unless it is retained */
+NRIndex *NRIndex_Get(RedisModuleCtx *ctx, RedisModuleString *hashKey);
+
+/* Make idx the index of hashKey, releasing the one it replaces. Must be
+ * called with the GIL held */
+void NRIndex_Set(RedisModuleCtx *ctx, RedisModuleString *hashKey, NRIndex *idx);
+
+/* Drop the indexes of the hashes of db, of every db if db is -1, once it is
+ * flushed. Must be called with the GIL held */
+void NRIndex_FlushDb(int db);
+
+/* Have the indexes of db a and db b follow their hashes once the dbs are
+ * swapped. Must be called with the GIL held */
+void NRIndex_SwapDb(int a, int b);
+
+/* Register the indexes with Redis. They are kept in module memory, by the
+ * name of the hash, so commands only touch the keys they are given. Only
+ * their schemas are saved, as aux data of the RDB, the indexes are loaded
+ * stale and their docs are read again by the first search, see
+ * NRIndex_Rebuild. An AOF only carries them with aof-use-rdb-preamble, the
+ * load warns when appendonly is on without it */
+int NRIndex_RegisterType(RedisModuleCtx *ctx);
+
+#endif
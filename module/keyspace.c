@@ -0,0 +1,171 @@
+#define REDISMODULE_EXPERIMENTAL_API
+#include <string.h>
+#include <strings.h>
+#include "keyspace.h"
+#include "index.h"
+#include "cache.h"
+
+/*
+* The hash write currently being executed, captured by the command filter.
+* Notifications don't carry field names, so this is what lets us update only
+* the fields a command touched. The key and the fields are copied back to back
+* into buf, as the filtered argv may be gone by the time a stale capture is
+* looked at. Only touched from the main thread.
+*/
+static struct {
+  int active;
+  size_t keyLen;
+  Vector *fieldLens;
+  char *buf;
+  size_t len;
+  size_t cap;
+} lastWrite;
+
+static void captureAppend(const RedisModuleString *s, size_t *outLen) {
+  size_t len;
+  const char *ptr = RedisModule_StringPtrLen(s, &len);
+  if (lastWrite.len + len > lastWrite.cap) {
+    lastWrite.cap = (lastWrite.len + len) * 2;
+    lastWrite.buf = RedisModule_Realloc(lastWrite.buf, lastWrite.cap);
+  }
+  memcpy(lastWrite.buf + lastWrite.len, ptr, len);
+  lastWrite.len += len;
+  *outLen = len;
+}
+
+static void captureHashWrite(RedisModuleCommandFilterCtx *fctx) {
+  lastWrite.active = 0;
+
+  int argc = RedisModule_CommandFilterArgsCount(fctx);
+  if (argc < 3) return;
+  const char *cmd = RedisModule_StringPtrLen(RedisModule_CommandFilterArgGet(fctx, 0), NULL);
+  if (*cmd != 'h' && *cmd != 'H') return;
+
+  // position of the first field and the distance between fields
+  int step;
+  if (!strcasecmp(cmd, "hset") || !strcasecmp(cmd, "hmset") || !strcasecmp(cmd, "hsetnx") ||
+      !strcasecmp(cmd, "hincrby") || !strcasecmp(cmd, "hincrbyfloat")) {
+    step = 2;
+  } else if (!strcasecmp(cmd, "hdel")) {
+    step = 1;
+  } else {
+    return;
+  }
+
+  size_t len;
+  lastWrite.len = 0;
+  lastWrite.fieldLens->top = 0;
+  captureAppend(RedisModule_CommandFilterArgGet(fctx, 1), &lastWrite.keyLen);
+  for (int i = 2; i < argc; i += step) {
+    captureAppend(RedisModule_CommandFilterArgGet(fctx, i), &len);
+    Vector_Push(lastWrite.fieldLens, len);
+  }
+  lastWrite.active = 1;
+}
+
+static int isCapturedKey(RedisModuleString *key) {
+  size_t len;
+  const char *ptr = RedisModule_StringPtrLen(key, &len);
+  return lastWrite.active && len == lastWrite.keyLen && memcmp(ptr, lastWrite.buf, len) == 0;
+}
+
+/* Queue the captured fields of the hash as they are now, O(fields touched) */
+static void queueCapturedFields(RedisModuleCtx *ctx, NRIndex *idx, RedisModuleString *keyName) {
+  RedisModuleKey *key = RedisModule_OpenKey(ctx, keyName, REDISMODULE_READ);
+  const char *field = lastWrite.buf + lastWrite.keyLen;
+  size_t flen;
+  for (size_t i = 0; i < Vector_Size(lastWrite.fieldLens); i++) {
+    Vector_Get(lastWrite.fieldLens, i, &flen);
+    NRIndex_QueueHashField(idx, ctx, key, field, flen);
+    field += flen;
+  }
+  RedisModule_CloseKey(key);
+}
+
+/* Events after which the key no longer holds the hash it held */
+static int isRemoval(const char *event) {
+  return !strcmp(event, "del") || !strcmp(event, "expired") || !strcmp(event, "evicted") ||
+         !strcmp(event, "rename_from") || !strcmp(event, "move_from");
+}
+
+/* Events after which the key holds a hash we know nothing about */
+static int isReplacement(const char *event) {
+  return !strcmp(event, "rename_to") || !strcmp(event, "move_to") || !strcmp(event, "restore");
+}
+
+/* A hash without an index may have parsed docs in the parse cache, which only
+ * records what was written. Its next search re-reads it */
+static void trackCachedHash(RedisModuleCtx *ctx, int type, const char *event,
+                            RedisModuleString *key) {
+  if ((type & REDISMODULE_NOTIFY_HASH) && isCapturedKey(key)) {
+    const char *field = lastWrite.buf + lastWrite.keyLen;
+    size_t flen;
+    for (size_t i = 0; i < Vector_Size(lastWrite.fieldLens); i++) {
+      Vector_Get(lastWrite.fieldLens, i, &flen);
+      ParseCache_MarkDirty(ctx, key, field, flen);
+      field += flen;
+    }
+  } else if ((type & REDISMODULE_NOTIFY_HASH) || isRemoval(event) || isReplacement(event)) {
+    ParseCache_Invalidate(ctx, key);
+  }
+}
+
+static int onKeyspaceEvent(RedisModuleCtx *ctx, int type, const char *event,
+                           RedisModuleString *key) {
+  NRIndex *idx = NRIndex_Get(ctx, key);
+  if (idx == NULL) {
+    trackCachedHash(ctx, type, event, key);
+    lastWrite.active = 0;
+    return REDISMODULE_OK;
+  }
+
+  // a write not captured, e.g. one queued in MULTI, leaves the hash to the next search
+  if ((type & REDISMODULE_NOTIFY_HASH) && isCapturedKey(key)) {
+    queueCapturedFields(ctx, idx, key);
+  } else if (isRemoval(event)) {
+    NRIndex_QueueClear(idx);
+  } else if ((type & REDISMODULE_NOTIFY_HASH) || isReplacement(event)) {
+    NRIndex_MarkStale(idx);
+  }
+  NRIndex_TryApply(idx);
+
+  lastWrite.active = 0;
+  return REDISMODULE_OK;
+}
+
+/* A flushed db takes the indexes and cached docs of its hashes along, they
+* follow their hashes to the other db of a swap. Cached docs are only dropped */
+static void onServerEvent(RedisModuleCtx *ctx, RedisModuleEvent eid, uint64_t subevent,
+                          void *data) {
+  if (eid.id == REDISMODULE_EVENT_FLUSHDB && subevent == REDISMODULE_SUBEVENT_FLUSHDB_START) {
+    RedisModuleFlushInfo *fi = data;
+    NRIndex_FlushDb(fi->dbnum);
+    ParseCache_FlushDb(fi->dbnum);
+  } else if (eid.id == REDISMODULE_EVENT_SWAPDB) {
+    RedisModuleSwapDbInfo *si = data;
+    NRIndex_SwapDb(si->dbnum_first, si->dbnum_second);
+    ParseCache_FlushDb(si->dbnum_first);
+    ParseCache_FlushDb(si->dbnum_second);
+  }
+}
+
+int Keyspace_Subscribe(RedisModuleCtx *ctx) {
+  if (RedisModule_SubscribeToKeyspaceEvents == NULL || RedisModule_RegisterCommandFilter == NULL) {
+    return REDISMODULE_ERR;
+  }
+
+  lastWrite.fieldLens = NewVector(size_t, 8);
+  if (RedisModule_RegisterCommandFilter(ctx, captureHashWrite, REDISMODULE_CMDFILTER_NOSELF) ==
+      NULL) {
+    return REDISMODULE_ERR;
+  }
+  // before Redis 6 searches tell flushed hashes apart by their length, see NRIndex_Apply
+  if (RedisModule_SubscribeToServerEvent != NULL) {
+    RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_FlushDB, onServerEvent);
+    RedisModule_SubscribeToServerEvent(ctx, RedisModuleEvent_SwapDB, onServerEvent);
+  }
+  return RedisModule_SubscribeToKeyspaceEvents(
+      ctx, REDISMODULE_NOTIFY_HASH | REDISMODULE_NOTIFY_GENERIC | REDISMODULE_NOTIFY_EXPIRED |
+               REDISMODULE_NOTIFY_EVICTED,
+      onKeyspaceEvent);
+}
@@ -0,0 +1,23 @@
+#ifndef __NR_KEYSPACE_H__
+#define __NR_KEYSPACE_H__
+
+#include "../redismodule.h"
+
+/*
+* Keep indexes in sync with plain hash commands. A command filter remembers
+* the fields touched by the hash write being executed, and the keyspace
+* notification that follows it queues just those fields on the index of the
+* hash, applied at once unless a search is reading it. Deleting, expiring or
+* renaming a hash empties its index. Other writes, such as those of a
+* transaction, only mark the index stale, its next search reads the hash
+* again in chunks. Flushing a db drops the indexes of its hashes, swapping
+* two moves them along. Writes to hashes without an index only mark their
+* fields dirty in the parse cache.
+*
+* Returns REDISMODULE_ERR if the server lacks the notification API, in
+* which case indexes are only maintained by NR.HSET / NR.HDEL and the parse
+* cache must stay off.
+*/
+int Keyspace_Subscribe(RedisModuleCtx *ctx);
+
+#endif
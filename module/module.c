@@ -1,6 +1,7 @@
 #define REDISMODULE_EXPERIMENTAL_API
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <ctype.h>
 #include "../redismodule.h"
@@ -10,9 +11,30 @@
 #include "../rmutil/cJSON.h"
 #include "../rmutil/thread_pool.h"
 #include "../rmutil/string_pool.h"
+#include "../rmutil/heap.h"
+#include "../rmutil/casestr.h"
+#include "../rmutil/arena.h"
+#include "index.h"
+#include "keyspace.h"
+#include "config.h"
+#include "cache.h"
 
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 
+/* Docs per partition below which splitting a search costs more than it saves */
+#define PARTITION_MIN_DOCS 256
+
+/* Block size of the arenas of a query, one of them is kept between queries */
+#define QUERY_ARENA_BLOCK (16 * 1024)
+
+/* Filter fields, text fields and the sort field a search reads from a doc */
+#define MAX_FILTERS 10
+#define MAX_SEARCH_FIELDS (MAX_FILTERS / 2 + NR_NUM_TEXT_FIELDS + 1)
+
+/* Errors of searches shed under load, clients can retry them elsewhere */
+#define BUSY_QUEUE_FULL "BUSY too many searches queued, try again later"
+#define BUSY_QUEUE_AGE "BUSY search waited too long in the queue, try again later"
+
 StringPool *sm;
 
 int strnncmp(const char* s1, const char* s2, int n1, int n2)
@@ -24,60 +46,67 @@ int strnncmp(const char* s1, const char* s2, int n1, int n2)
     return n1 - n2;
 }
 
-char* strnncasestr(const char *str, const char *target, int n1, int n2) {
-  if (n1 < n2)
-    return NULL;
-
-  const char *p1 = str, *p2 = target;
-  char *p1b;
-  int l = n1 - n2 + 1;
-  int c = n2;
-  while (l--) {
-    p1b = p1;
-    while (tolower(*p1) == tolower(*p2) && c--) {
-      p1++;
-      p2++;
-    }
-    if (c == 0)
-      return p1b;
-    c = n2;
-    p1 = p1b + 1;
-    p2 = target;
-  }
-  return NULL;
-}
-
 typedef struct {
   RedisModuleBlockedClient *bc;
   RedisModuleString **argv;
   int argc;
+  long long queuedAt;  // ms
 } CommandCtx;
 
 typedef struct {
   RedisModuleString *key;
   const char *query;
-  const char *filters[10];
+  const char *filters[MAX_FILTERS];
   int len_query;
   int ct_filter;
   int page_start;
   int page_end;
   const char *sortName;
   int sortDirection;
+  // distinct keys extracted from scanned values, and where each role finds its value
+  const char *fields[MAX_SEARCH_FIELDS];
+  size_t fieldLens[MAX_SEARCH_FIELDS];
+  // fields as interned handles, to look up parsed docs. NULL for a field no doc has, so client
+  // supplied names never grow the string pool
+  const char *keys[MAX_SEARCH_FIELDS];
+  int numFields;
+  int filterField[MAX_FILTERS / 2];
+  int textField[NR_NUM_TEXT_FIELDS];
+  int sortField;
 } SearchForm;
 
-typedef struct {
-  cJSON *doc;
-  cJSON *sort;
-  RedisModuleString *rawString;
+/* A match kept for the page. Entities and the scanned fields and sort values they copy live in the
+ * arenas of the query, nothing is freed before the query is done */
+typedef struct entity {
+  const char *sort;   // NULL when the doc has no string sort value
+  size_t sortLen;
+  const char *raw;    // the doc as stored in the index, for an index search
+  size_t rawLen;
+  const char *field;  // the field of the scanned value, only fetched if it makes the page
+  size_t fieldLen;
+  struct entity *nextFree;
 } Entity;
 
 int compare(void *arg, const void *a, const void *b) {
   Entity *ext1 = *(Entity **)a;
   Entity *ext2 = *((Entity **)b);
   int sort = *(int *)arg;
-  cJSON *pin1 = ext1->sort;
-  cJSON *pin2 = ext2->sort;
-  return sort * strnncmp(pin1->valuestring, pin2->valuestring, abs(pin1->valueint), abs(pin2->valueint));
+  // documents without a sort value always go last
+  if (ext1->sort == NULL || ext2->sort == NULL) {
+    return (ext1->sort == NULL) - (ext2->sort == NULL);
+  }
+  return sort * strnncmp(ext1->sort, ext2->sort, ext1->sortLen, ext2->sortLen);
+}
+
+/* compare for the top-K heap, which has no room for the direction */
+int compareAsc(void *a, void *b) {
+  int sort = 1;
+  return compare(&sort, a, b);
+}
+
+int compareDesc(void *a, void *b) {
+  int sort = -1;
+  return compare(&sort, a, b);
 }
 
 void FreeArgv(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
@@ -87,6 +116,26 @@ void FreeArgv(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   RedisModule_Free(argv);
 }
 
+/* Return the position of field among the extracted fields, adding it if new */
+int AddSearchField(SearchForm *form, const char *field) {
+  size_t len = strlen(field);
+  for (int i = 0; i < form->numFields; i++) {
+    if (form->fieldLens[i] == len && memcmp(form->fields[i], field, len) == 0) return i;
+  }
+  form->fields[form->numFields] = field;
+  form->fieldLens[form->numFields] = len;
+  form->keys[form->numFields] = cJSON_KeyHandle(field);
+  return form->numFields++;
+}
+
+/* Resolve again the fields no parsed doc had a key for when the form was made. The docs of an
+ * index or cache entry are all parsed once its lock is held, a key new since then has a handle */
+void ResolveSearchKeys(SearchForm *form) {
+  for (int i = 0; i < form->numFields; i++) {
+    if (form->keys[i] == NULL) form->keys[i] = cJSON_KeyHandle(form->fields[i]);
+  }
+}
+
 void InitSearchFrom(SearchForm *form, RedisModuleString **argv, int argc) {
   form->key = argv[1];
   form->query = RedisModule_StringPtrLen(argv[2], NULL);
@@ -105,35 +154,659 @@ void InitSearchFrom(SearchForm *form, RedisModuleString **argv, int argc) {
       form->filters[i] = RedisModule_StringPtrLen(argv[6 + i], NULL);
     }
   }
+
+  form->numFields = 0;
+  for (int i = 0; i < form->ct_filter; i += 2) {
+    form->filterField[i / 2] = AddSearchField(form, form->filters[i]);
+  }
+  for (int j = 0; j < NR_NUM_TEXT_FIELDS; j++) {
+    form->textField[j] = AddSearchField(form, NRTextFields[j]);
+  }
+  form->sortField = AddSearchField(form, form->sortName);
 }
 
-int IsMatch(cJSON *doc, SearchForm *form) {
-  cJSON *json_value;
-  const static char *fields[] = {"name", "department", "pin", "number"};
-  if (form->ct_filter > 0) {
-    for (int i = 0; i < form->ct_filter; i += 2) {
-      json_value = cJSON_GetObjectItem(doc, form->filters[i]);
-      if(json_value==NULL)
-        return 0;
-      if (strnncmp(json_value->valuestring, form->filters[i + 1], abs(json_value->valueint), strlen(form->filters[i + 1])) != 0) {
-        return 0;
-      }
-    }
+/* value is NULL when the field is missing or isn't a string */
+int FilterMatches(const char *value, size_t len, const char *filter) {
+  if (value == NULL)
+    return 0;
+  return strnncmp(value, filter, len, strlen(filter)) == 0;
+}
+
+int QueryMatches(const char *value, size_t len, SearchForm *form) {
+  if (value == NULL)
+    return 0;
+  return casestr_find(value, len, form->query, form->len_query) != NULL;
+}
+
+/* String of a value extracted by cJSON_Extract, NULL if it has none */
+const char *ExtractedString(cJSON *value, size_t *len) {
+  if (value->type != cJSON_String) return NULL;
+  *len = abs(value->valueint);
+  return value->valuestring;
+}
+
+/* What is left to check on the candidates of an index search, none when they are the matches */
+#define CHECK_FILTERS 1
+#define CHECK_TEXT 2
+
+int IsMatch(cJSON_Tape *doc, SearchForm *form, int checks) {
+  const char *value;
+  size_t len = 0;
+  for (int i = 0; i < form->ct_filter && (checks & CHECK_FILTERS); i += 2) {
+    value = cJSON_TapeGetString(doc, form->keys[form->filterField[i / 2]], &len);
+    if (!FilterMatches(value, len, form->filters[i + 1]))
+      return 0;
+  }
+  if(form->len_query == 0 || !(checks & CHECK_TEXT))
+    return 1;
+  for (int j = 0; j < NR_NUM_TEXT_FIELDS; j++) {
+    value = cJSON_TapeGetString(doc, form->keys[form->textField[j]], &len);
+    if (QueryMatches(value, len, form))
+      return 1;
+  }
+  return 0;
+}
+
+/* IsMatch on the values extracted by cJSON_Extract for form->fields */
+int IsExtractedMatch(cJSON *values, SearchForm *form) {
+  const char *value;
+  size_t len = 0;
+  for (int i = 0; i < form->ct_filter; i += 2) {
+    value = ExtractedString(&values[form->filterField[i / 2]], &len);
+    if (!FilterMatches(value, len, form->filters[i + 1]))
+      return 0;
   }
   if(form->len_query == 0)
     return 1;
-  for (int j = 0; j < 4; j++) {
-    json_value = cJSON_GetObjectItem(doc, fields[j]);
-    if(json_value==NULL)
-        continue;
-    // strstr case sensitive
-    if (strnncasestr(json_value->valuestring, form->query, abs(json_value->valueint), form->len_query)) {
+  for (int j = 0; j < NR_NUM_TEXT_FIELDS; j++) {
+    value = ExtractedString(&values[form->textField[j]], &len);
+    if (QueryMatches(value, len, form))
       return 1;
-    }
   }
   return 0;
 }
 
+/* Matches of one partition of a search, merged once all partitions are done */
+typedef struct {
+  Vector *top;
+  size_t total;
+  Arena *arena;      // where the entities of the partition are allocated
+  Entity *recycled;  // entities evicted from top, reused before allocating new ones
+  Dict *held;        // fields of the matches in top for a scan, NULL otherwise
+} SearchPartition;
+
+/* Per worker arenas, one per partition of the query it runs, reset once it replied. A partition
+ * may run on a helper thread but its entities are merged and replied by the worker, so they must
+ * come from the worker's arenas */
+static pthread_key_t queryArenasKey;
+
+void FreeQueryArenas(void *arg) {
+  Vector *arenas = arg;
+  Arena *a;
+  for (size_t i = 0; i < Vector_Size(arenas); i++) {
+    Vector_Get(arenas, i, &a);
+    Arena_Free(a);
+  }
+  Vector_Free(arenas);
+}
+
+/* Arena of partition i of the query the calling worker runs */
+Arena *QueryArena(int i) {
+  Vector *arenas = pthread_getspecific(queryArenasKey);
+  if (arenas == NULL) {
+    arenas = NewVector(Arena *, 4);
+    pthread_setspecific(queryArenasKey, arenas);
+  }
+  while (Vector_Size(arenas) <= i) {
+    Vector_Push(arenas, NewArena(QUERY_ARENA_BLOCK));
+  }
+  Arena *a;
+  Vector_Get(arenas, i, &a);
+  return a;
+}
+
+/* Release everything the queries of the calling worker allocated */
+void ResetQueryArenas() {
+  Vector *arenas = pthread_getspecific(queryArenasKey);
+  if (arenas == NULL) return;
+  Arena *a;
+  for (size_t i = 0; i < Vector_Size(arenas); i++) {
+    Vector_Get(arenas, i, &a);
+    Arena_Reset(a);
+  }
+}
+
+Entity *NewEntity(SearchPartition *p) {
+  Entity *ext = p->recycled;
+  if (ext == NULL) return Arena_Alloc(p->arena, sizeof(Entity));
+  p->recycled = ext->nextFree;
+  return ext;
+}
+
+void RecycleEntity(SearchPartition *p, Entity *ext) {
+  ext->nextFree = p->recycled;
+  p->recycled = ext;
+}
+
+/*
+* Keep ext if it is among the page_end first matches seen so far. The kept
+* ones form a max-heap whose top is the one sorting last, so a newcomer only
+* has to beat it. Losers are recycled right away, which keeps the memory of a
+* search bounded by the page size. Returns the entity that left the heap, ext
+* itself if it didn't make it, or NULL. It stays readable until p allocates the
+* next one.
+*/
+Entity *CollectEntity(SearchPartition *p, Entity *ext, SearchForm *form) {
+  int (*cmp)(void *, void *) = form->sortDirection == 1 ? compareAsc : compareDesc;
+  size_t k = form->page_end > 0 ? form->page_end : 0;
+  Vector *top = p->top;
+
+  if (Vector_Size(top) < k) {
+    Vector_Push(top, ext);
+    Heap_Push(top, 0, Vector_Size(top), cmp);
+    return NULL;
+  }
+
+  Entity *worst = NULL;
+  Vector_Get(top, 0, &worst);
+  if (worst == NULL || cmp(&ext, &worst) >= 0) {
+    RecycleEntity(p, ext);
+    return ext;
+  }
+  // the worst goes to the end of the heap, where it is replaced by ext
+  Heap_Pop(top, 0, k, cmp);
+  Vector_Put(top, k - 1, ext);
+  Heap_Push(top, 0, k, cmp);
+  RecycleEntity(p, worst);
+  return worst;
+}
+
+/* Sort the kept matches and reply with the total count followed by the requested page */
+void ReplyWithPage(RedisModuleCtx *ctx, Vector *top, size_t total, SearchForm *form) {
+  Entity *ext;
+  if (total == 0) {
+    RedisModule_ReplyWithNull(ctx);
+    return;
+  }
+
+  size_t kept = Vector_Size(top);
+  if (kept > 1) {
+    Vector_Sort(top, &form->sortDirection, compare);
+  }
+
+  RedisModule_ReplyWithArray(ctx, (kept > form->page_start ? kept - form->page_start : 0) + 1);
+  RedisModule_ReplyWithDouble(ctx, total);
+  for (size_t idx = 0; idx < kept; idx++) {
+    Vector_Get(top, idx, &ext);
+    if (idx >= form->page_start) {
+      RedisModule_ReplyWithStringBuffer(ctx, ext->raw, ext->rawLen);
+    }
+  }
+}
+
+/*
+* ReplyWithPage for the matches of a scan, which only hold the field of their
+* value. The values of the page are fetched with HMGET, NR_SCAN_CHUNK_SIZE at
+* a time so the GIL is never held for long, the matches ranking before the
+* page are never fetched. A value written since it matched is replied as it is
+* now, one deleted since is left out of the page but still counted.
+*/
+void ReplyWithScannedPage(RedisModuleCtx *ctx, Vector *top, size_t total, SearchForm *form) {
+  Entity *ext;
+  if (total == 0) {
+    RedisModule_ReplyWithNull(ctx);
+    return;
+  }
+
+  size_t kept = Vector_Size(top);
+  if (kept > 1) {
+    Vector_Sort(top, &form->sortDirection, compare);
+  }
+
+  RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
+  RedisModule_ReplyWithDouble(ctx, total);
+  long replied = 1;
+  RedisModuleString **fields = RedisModule_Alloc(NR_SCAN_CHUNK_SIZE * sizeof(RedisModuleString *));
+  for (size_t from = form->page_start; from < kept; from += NR_SCAN_CHUNK_SIZE) {
+    size_t n = min(kept - from, (size_t)NR_SCAN_CHUNK_SIZE);
+    for (size_t i = 0; i < n; i++) {
+      Vector_Get(top, from + i, &ext);
+      fields[i] = RedisModule_CreateString(ctx, ext->field, ext->fieldLen);
+    }
+
+    RedisModule_ThreadSafeContextLock(ctx);
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, "HMGET", "sv", form->key, fields, n);
+    RedisModule_ThreadSafeContextUnlock(ctx);
+
+    for (size_t i = 0; i < n; i++) {
+      RedisModule_FreeString(ctx, fields[i]);
+    }
+    // the hash itself may be gone or replaced since, then nothing more is replied
+    if (reply == NULL) continue;
+    if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ARRAY) {
+      for (size_t i = 0; i < n; i++) {
+        RedisModuleCallReply *value = RedisModule_CallReplyArrayElement(reply, i);
+        if (value == NULL || RedisModule_CallReplyType(value) != REDISMODULE_REPLY_STRING) continue;
+        size_t len;
+        const char *raw = RedisModule_CallReplyStringPtr(value, &len);
+        RedisModule_ReplyWithStringBuffer(ctx, raw, len);
+        replied++;
+      }
+    }
+    RedisModule_FreeCallReply(reply);
+  }
+  RedisModule_Free(fields);
+  RedisModule_ReplySetArrayLength(ctx, replied);
+}
+
+/* Split a search over that many docs between as many pool threads as it's worth */
+int NumPartitions(size_t numDocs) {
+  size_t n = numDocs / PARTITION_MIN_DOCS;
+  return n < 1 ? 1 : min(n, (size_t)tpool_num_threads());
+}
+
+SearchPartition *NewPartitions(int n, SearchForm *form) {
+  SearchPartition *parts = RedisModule_Calloc(n, sizeof(SearchPartition));
+  for (int i = 0; i < n; i++) {
+    parts[i].top = NewVector(Entity *, min(200, form->page_end > 0 ? form->page_end : 0));
+    parts[i].arena = QueryArena(i);
+  }
+  return parts;
+}
+
+/* CollectEntity for a scanned match whose field p does not hold yet, keeping held up to date */
+void CollectScanned(SearchPartition *p, Entity *ext, SearchForm *form) {
+  Dict_Set(p->held, ext->field, ext->fieldLen, ext);
+  Entity *left = CollectEntity(p, ext, form);
+  if (left) Dict_Delete(p->held, left->field, left->fieldLen);
+}
+
+/* Merge the local top-K of the partitions into one and free them, the entities stay in the arenas
+ * of the query. A field two partitions of a scan both kept is only kept and counted once */
+Vector *MergePartitions(SearchPartition *parts, int n, SearchForm *form, size_t *total) {
+  Vector *top = parts[0].top;
+  *total = parts[0].total;
+  Entity *ext;
+  for (int i = 1; i < n; i++) {
+    *total += parts[i].total;
+    for (size_t j = 0; j < Vector_Size(parts[i].top); j++) {
+      Vector_Get(parts[i].top, j, &ext);
+      if (parts[0].held == NULL) {
+        CollectEntity(&parts[0], ext, form);
+      } else if (Dict_Get(parts[0].held, ext->field, ext->fieldLen) == NULL) {
+        CollectScanned(&parts[0], ext, form);
+      } else {
+        (*total)--;
+      }
+    }
+    Vector_Free(parts[i].top);
+    if (parts[i].held) Dict_Free(parts[i].held, NULL);
+  }
+  if (parts[0].held) Dict_Free(parts[0].held, NULL);
+  RedisModule_Free(parts);
+  return top;
+}
+
+void AddIndexDoc(NRDoc *d, SearchForm *form, SearchPartition *p) {
+  Entity *ext = NewEntity(p);
+  ext->sort = cJSON_TapeGetString(d->tape, form->keys[form->sortField], &ext->sortLen);
+  ext->raw = d->raw;
+  ext->rawLen = d->rawLen;
+  CollectEntity(p, ext, form);
+  p->total++;
+}
+
+void SearchIndexDoc(NRDoc *d, SearchForm *form, int checks, SearchPartition *p) {
+  if (d == NULL || d->tape == NULL) return;
+
+  if (IsMatch(d->tape, form, checks) == 1) {
+    AddIndexDoc(d, form, p);
+  }
+}
+
+/* Candidates of a predicate beyond this share of the docs are cheaper to find by scanning a
+ * column than to check one by one */
+#define COLUMN_SCAN_SHARE 8
+
+int WorthScanning(NRIndex *idx, Bitmap *candidates) {
+  return candidates == NULL || Bitmap_Cardinality(candidates) * COLUMN_SCAN_SHARE > idx->numDocs;
+}
+
+/* Keep the candidates that are in docs, which is freed. NULL candidates stand for every doc */
+Bitmap *NarrowCandidates(Bitmap *candidates, Bitmap *docs) {
+  if (candidates == NULL) return docs;
+  Bitmap_AndInPlace(candidates, docs);
+  Bitmap_Free(docs);
+  return candidates;
+}
+
+/*
+* Narrow the search down with the tag and trigram indexes and the text
+* columns. Returns NULL when they can't, meaning every doc is a candidate.
+* checks is set to what the candidates must still be checked for. Filters on
+* TAG fields are always exact, the text query and filters on text fields are
+* matched over the whole column when too many candidates are left to check
+* them doc by doc. Filters on dictionary encoded columns always are, as that
+* only compares a byte per doc.
+*/
+Bitmap *SearchCandidates(NRIndex *idx, SearchForm *form, int *checks) {
+  Bitmap *candidates = NULL;
+  *checks = 0;
+
+  for (int i = 0; i < form->ct_filter; i += 2) {
+    NRTagIndex *tag = NRIndex_GetTag(idx, form->filters[i]);
+    if (tag == NULL) continue;
+    Bitmap *docs = NRTagIndex_Docs(tag, form->filters[i + 1], strlen(form->filters[i + 1]));
+    if (docs == NULL) {
+      if (candidates) Bitmap_Free(candidates);
+      return NewBitmap();
+    }
+    if (candidates == NULL) {
+      candidates = Bitmap_Copy(docs);
+    } else {
+      Bitmap_AndInPlace(candidates, docs);
+    }
+  }
+
+  if (form->len_query > 0) {
+    Bitmap *docs = NRIndex_TextCandidates(idx, form->query, form->len_query);
+    if (docs) candidates = NarrowCandidates(candidates, docs);
+    if (WorthScanning(idx, candidates)) {
+      docs = NRIndex_TextMatches(idx, form->query, form->len_query);
+      candidates = NarrowCandidates(candidates, docs);
+    } else {
+      *checks |= CHECK_TEXT;
+    }
+  }
+
+  for (int i = 0; i < form->ct_filter; i += 2) {
+    if (NRIndex_GetTag(idx, form->filters[i])) continue;
+    Column *column = NRIndex_GetColumn(idx, form->filters[i]);
+    if (column && (Column_IsEncoded(column) || WorthScanning(idx, candidates))) {
+      Bitmap *docs = NewBitmap();
+      Column_Equals(column, form->filters[i + 1], strlen(form->filters[i + 1]), docs);
+      candidates = NarrowCandidates(candidates, docs);
+    } else {
+      *checks |= CHECK_FILTERS;
+    }
+  }
+  return candidates;
+}
+
+/* Count d if it matches and keep it if it falls in the page. Returns 1 once
+ * the rest of the walk can be skipped */
+int VisitOrderedDoc(NRDoc *d, Bitmap *candidates, int checks, SearchForm *form, size_t *total,
+                    Vector *page) {
+  if (candidates && !Bitmap_Contains(candidates, d->id)) return 0;
+  if (checks && IsMatch(d->tape, form, checks) != 1) return 0;
+
+  if (*total >= form->page_start && *total < form->page_end) {
+    Vector_Push(page, d);
+  }
+  (*total)++;
+  return !checks && *total >= form->page_end;
+}
+
+/*
+* Walk the docs in the order of a SORTABLE field, keeping only the requested
+* page, so nothing is sorted. With nothing left to check the total is known and the
+* walk stops at the end of the page, otherwise the remaining docs are only
+* counted. Docs without the field come last, like in the sorted search.
+*/
+void SearchIndexOrdered(RedisModuleCtx *ctx, NRIndex *idx, NRSortIndex *sortable,
+                        Bitmap *candidates, int checks, SearchForm *form) {
+  Vector *page = NewVector(NRDoc *, 16);
+  size_t total = 0;
+  int done = 0;
+
+  SkipListNode *n = form->sortDirection == 1 ? SkipList_First(sortable->order)
+                                              : SkipList_Last(sortable->order);
+  while (n && !done) {
+    done = VisitOrderedDoc(idx->docs[n->id], candidates, checks, form, &total, page);
+    n = form->sortDirection == 1 ? SkipListNode_Next(n) : SkipListNode_Prev(n);
+  }
+  BitmapIterator it = Bitmap_Iterate(sortable->missing);
+  uint32_t id;
+  while (!done && BitmapIterator_Next(&it, &id)) {
+    done = VisitOrderedDoc(idx->docs[id], candidates, checks, form, &total, page);
+  }
+  if (done) {
+    total = candidates ? Bitmap_Cardinality(candidates)
+                       : sortable->order->length + Bitmap_Cardinality(sortable->missing);
+  }
+
+  if (total == 0) {
+    RedisModule_ReplyWithNull(ctx);
+  } else {
+    NRDoc *d;
+    RedisModule_ReplyWithArray(ctx, Vector_Size(page) + 1);
+    RedisModule_ReplyWithDouble(ctx, total);
+    for (size_t i = 0; i < Vector_Size(page); i++) {
+      Vector_Get(page, i, &d);
+      RedisModule_ReplyWithStringBuffer(ctx, d->raw, d->rawLen);
+    }
+  }
+  Vector_Free(page);
+}
+
+typedef struct {
+  RedisModuleCtx *ctx;
+  NRIndex *idx;
+  SearchForm *form;
+  uint32_t *ids;  // candidate doc ids, NULL to look at every doc slot
+  size_t numIds;  // number of candidates or of doc slots
+  int checks;
+  SearchPartition *parts;
+  int numParts;
+} IndexSearch;
+
+void SearchIndexPartition(void *arg, int part) {
+  IndexSearch *search = arg;
+  SearchPartition *p = &search->parts[part];
+  size_t from = search->numIds * part / search->numParts;
+  size_t to = search->numIds * (part + 1) / search->numParts;
+
+  for (size_t i = from; i < to; i++) {
+    NRDoc *d = search->idx->docs[search->ids ? search->ids[i] : i];
+    if (search->ids && !search->checks) {
+      AddIndexDoc(d, search->form, p);
+    } else {
+      SearchIndexDoc(d, search->form, search->checks, p);
+    }
+  }
+}
+
+/* Search the pre-parsed documents of an index, no JSON is parsed here. Only
+ * the candidates of the indexes and column scans are looked at, if any. Big
+ * searches are split into partitions matched in parallel by the pool, each
+ * keeping its own top-K, which are merged for the reply */
+void SearchIndex(RedisModuleCtx *ctx, NRIndex *idx, SearchForm *form) {
+  NRIndex_ReadLock(idx);
+  ResolveSearchKeys(form);
+  int checks;
+  Bitmap *candidates = SearchCandidates(idx, form, &checks);
+  size_t n = candidates ? Bitmap_Cardinality(candidates) : idx->numDocs;
+
+  // walking the order is only worth it when a good part of the docs are candidates,
+  // sorting a handful of matches is cheaper than skipping over the rest
+  NRSortIndex *sortable = NRIndex_GetSortable(idx, form->sortName);
+  if (sortable && n * 8 >= idx->numDocs) {
+    SearchIndexOrdered(ctx, idx, sortable, candidates, checks, form);
+    if (candidates) Bitmap_Free(candidates);
+    NRIndex_Unlock(idx);
+    return;
+  }
+
+  // the candidates are turned into a list so they split evenly between partitions
+  // without candidates every slot is looked at, free and invalid ones included
+  IndexSearch search = {.ctx = ctx, .idx = idx, .form = form, .checks = checks};
+  if (candidates) {
+    search.ids = Arena_Alloc(QueryArena(0), (n ? n : 1) * sizeof(uint32_t));
+    BitmapIterator it = Bitmap_Iterate(candidates);
+    while (BitmapIterator_Next(&it, &search.ids[search.numIds])) search.numIds++;
+    Bitmap_Free(candidates);
+  } else {
+    search.numIds = idx->top;
+  }
+
+  search.numParts = NumPartitions(search.numIds);
+  search.parts = NewPartitions(search.numParts, form);
+  tpool_run_parallel(search.numParts, SearchIndexPartition, &search);
+
+  size_t total;
+  Vector *top = MergePartitions(search.parts, search.numParts, form, &total);
+  ReplyWithPage(ctx, top, total, form);
+  Vector_Free(top);
+  NRIndex_Unlock(idx);
+}
+
+/* Tell if a match sorting by sort would make it into the heap of CollectEntity */
+int TopAccepts(Vector *top, const char *sort, size_t sortLen, SearchForm *form) {
+  size_t k = form->page_end > 0 ? form->page_end : 0;
+  if (Vector_Size(top) < k) return 1;
+  if (k == 0) return 0;
+
+  Entity candidate = {.sort = sort, .sortLen = sortLen}, *ext = &candidate, *worst;
+  Vector_Get(top, 0, &worst);
+  return (form->sortDirection == 1 ? compareAsc : compareDesc)(&ext, &worst) < 0;
+}
+
+/* Copy the field and sort value of a scanned match that made it into the heap in the arena of p,
+ * they must outlive their chunk. The value itself is fetched again if it makes the page */
+Entity *NewScanEntity(SearchPartition *p, const char *field, size_t flen, const char *sort,
+                      size_t sortLen) {
+  Entity *ext = NewEntity(p);
+  char *copy = Arena_Alloc(p->arena, flen + (sort ? sortLen : 0) + 1);
+  memcpy(copy, field, flen);
+  ext->field = copy;
+  ext->fieldLen = flen;
+  ext->sort = NULL;
+  if (sort) {
+    memcpy(copy + flen, sort, sortLen);
+    ext->sort = copy + flen;
+    ext->sortLen = sortLen;
+  }
+  return ext;
+}
+
+typedef struct {
+  RedisModuleCtx *ctx;
+  SearchForm *form;
+  RedisModuleCallReply *items;  // field/value pairs of the current chunk
+  size_t numPairs;
+  SearchPartition *parts;  // one per pool thread, kept across chunks
+  int numParts;            // partitions of the current chunk
+} ScanSearch;
+
+/*
+* Match a share of the values of one HSCAN chunk. Only the fields the search
+* reads are extracted, in place from the reply buffer, which is NULL
+* terminated past the last element. Matches entering the heap only keep their
+* field and sort value, never the value. A field seen twice, which HSCAN
+* allows while the hash is rehashing, is skipped while its match is in the
+* heap of the partition. Only the fields of the heap are remembered, so one
+* that fell out of it sorts after the page again but is counted twice.
+*/
+void SearchScanPartition(void *arg, int part) {
+  ScanSearch *search = arg;
+  SearchPartition *p = &search->parts[part];
+  size_t from = search->numPairs * part / search->numParts;
+  size_t to = search->numPairs * (part + 1) / search->numParts;
+
+  SearchForm *form = search->form;
+  cJSON values[MAX_SEARCH_FIELDS];
+  const char *end;
+  size_t flen, vlen;
+  for (size_t i = from * 2; i < to * 2; i += 2) {
+    const char *value = RedisModule_CallReplyStringPtr(
+        RedisModule_CallReplyArrayElement(search->items, i + 1), &vlen);
+    end = cJSON_Extract(value, form->fields, form->fieldLens, form->numFields, values);
+    if (end == NULL) continue;
+    // a truncated value could have been parsed from the bytes of the next one
+    if (end > value + vlen) {
+      cJSON_FreeExtracted(values, form->numFields);
+      continue;
+    }
+
+    if (IsExtractedMatch(values, form) == 1) {
+      const char *field = RedisModule_CallReplyStringPtr(
+          RedisModule_CallReplyArrayElement(search->items, i), &flen);
+      if (Dict_Get(p->held, field, flen) == NULL) {
+        p->total++;
+        size_t sortLen;
+        const char *sort = ExtractedString(&values[form->sortField], &sortLen);
+        if (TopAccepts(p->top, sort, sortLen, form)) {
+          CollectScanned(p, NewScanEntity(p, field, flen, sort, sortLen), form);
+        }
+      }
+    }
+    cJSON_FreeExtracted(values, form->numFields);
+  }
+}
+
+/*
+* Search a hash that has no index. The hash is read with HSCAN in chunks of
+* about NR_SCAN_CHUNK_SIZE fields and the GIL is only held while a chunk is
+* fetched, so the main thread is never stalled for long, however big the hash.
+* Each chunk is split between the pool threads.
+*/
+void SearchScan(RedisModuleCtx *ctx, SearchForm *form) {
+  ScanSearch search = {.ctx = ctx, .form = form};
+  int maxParts = tpool_num_threads();
+  search.parts = NewPartitions(maxParts, form);
+  for (int i = 0; i < maxParts; i++) {
+    search.parts[i].held = NewDict(64);
+  }
+  char cursor[32] = "0";
+  size_t len;
+
+  do {
+    RedisModule_ThreadSafeContextLock(ctx);
+    RedisModuleCallReply *reply = RedisModule_Call(ctx, "HSCAN", "sccl", form->key, cursor,
+                                                   "COUNT", (long long)NR_SCAN_CHUNK_SIZE);
+    RedisModule_ThreadSafeContextUnlock(ctx);
+
+    if (reply == NULL) {
+      RedisModule_ReplyWithError(ctx, "ERR reply is NULL");
+      goto cleanup;
+    } else if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR) {
+      RedisModule_ReplyWithCallReply(ctx, reply);
+      RedisModule_FreeCallReply(reply);
+      goto cleanup;
+    }
+
+    const char *next = RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(reply, 0),
+                                                      &len);
+    len = min(len, sizeof(cursor) - 1);
+    memcpy(cursor, next, len);
+    cursor[len] = '\0';
+
+    // replies are parsed lazily, the chunk must be parsed here before the
+    // partitions read its elements concurrently
+    search.items = RedisModule_CallReplyArrayElement(reply, 1);
+    search.numPairs = RedisModule_CallReplyLength(search.items) / 2;
+    // the pool may have grown since the partitions were allocated
+    search.numParts = min(NumPartitions(search.numPairs), maxParts);
+    tpool_run_parallel(search.numParts, SearchScanPartition, &search);
+    RedisModule_FreeCallReply(reply);
+  } while (strcmp(cursor, "0") != 0);
+
+  size_t total;
+  Vector *top = MergePartitions(search.parts, maxParts, form, &total);
+  ReplyWithScannedPage(ctx, top, total, form);
+  Vector_Free(top);
+  search.parts = NULL;
+
+cleanup:
+  if (search.parts) {
+    for (int i = 0; i < maxParts; i++) {
+      Vector_Free(search.parts[i].top);
+      Dict_Free(search.parts[i].held, NULL);
+    }
+    RedisModule_Free(search.parts);
+  }
+}
+
 void *DoSearch(void *arg) {
   CommandCtx *cctx = arg;
 
@@ -142,114 +815,314 @@ void *DoSearch(void *arg) {
   RedisModuleBlockedClient *bc = cctx->bc;
   RedisModuleString **argv = cctx->argv;
   int argc = cctx->argc;
+  long long queuedAt = cctx->queuedAt;
   RedisModule_Free(cctx);
 
   RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(bc);
 
-  // get element to search
-  RedisModule_ThreadSafeContextLock(ctx);
-  RedisModuleCallReply *reply = RedisModule_Call(ctx, "HVALS", "s", form.key);
-  RedisModule_ThreadSafeContextUnlock(ctx);
-
-  if (reply == NULL) {
-    RedisModule_ReplyWithError(ctx, "ERR reply is NULL");
-    goto free_argv;
-  } else if (RedisModule_CallReplyType(reply) == REDISMODULE_REPLY_ERROR) {
-    RedisModule_ReplyWithCallReply(ctx, reply);
-    goto free_reply;
+  // the client has likely given up on a search that waited this long,
+  // running it would only delay the ones queued after it
+  if (nrConfig.maxQueueAge > 0 && RedisModule_Milliseconds() - queuedAt > nrConfig.maxQueueAge) {
+    RedisModule_ReplyWithError(ctx, BUSY_QUEUE_AGE);
+    goto done;
   }
 
-  size_t ct_reply = RedisModule_CallReplyLength(reply);
-  Vector *res = NewVector(Entity *, min(200, ct_reply));
-
-  Entity *ext;
-  cJSON *doc;
-  RedisModuleCallReply *cr_ext;
-  RedisModuleString *json_body;
-  for (int i = 0; i < ct_reply; i++) {
-    cr_ext = RedisModule_CallReplyArrayElement(reply, i);
-    json_body = RedisModule_CreateStringFromCallReply(cr_ext);
-    doc = cJSON_Parse(RedisModule_StringPtrLen(json_body, NULL));
-
-    if(doc == NULL)
-        continue;
-
-    if (IsMatch(doc, &form) == 1) {
-      ext = RedisModule_Alloc(sizeof(Entity));
-      ext->doc = doc;
-      ext->sort = cJSON_GetObjectItem(doc, form.sortName);
-      ext->rawString = json_body;
-      Vector_Push(res, ext);
-    } else {
-      RedisModule_FreeString(ctx, json_body);
-      cJSON_Delete(doc);
-    }
+  // use the index of the hash if there is one, then its cached docs, otherwise scan it
+  RedisModule_ThreadSafeContextLock(ctx);
+  NRIndexMark mark;
+  NRIndex *idx = NRIndex_Get(ctx, form.key);
+  ParseCacheEntry *fill = NULL;
+  if (idx != NULL) {
+    NRIndex_Retain(idx);
+    NRIndex_Mark(idx, ctx, form.key, &mark);
+  } else if ((idx = ParseCache_Get(ctx, form.key, &mark)) == NULL) {
+    fill = ParseCache_StartFill(ctx, form.key);
   }
+  RedisModule_ThreadSafeContextUnlock(ctx);
 
-  if (Vector_Size(res) > form.page_start + 1 && ext-> sort != NULL) {
-    Vector_Sort(res, &form.sortDirection, compare);
+  // a hash that isn't cached yet is parsed whole once, then searched like an index
+  if (fill != NULL) {
+    idx = ParseCache_Fill(ctx, fill, form.key, &mark);
   }
-
-  if (Vector_Size(res) > 0) {
-    RedisModule_ReplyWithArray(ctx, min(Vector_Size(res), form.page_end) - form.page_start + 1);
-    RedisModule_ReplyWithDouble(ctx, Vector_Size(res));
-    for (size_t idx = 0; idx < Vector_Size(res); idx++) {
-      Vector_Get(res, idx, &ext);
-      cJSON_Delete(ext->doc);
-      if (idx >= form.page_start && idx < form.page_end) {
-        RedisModule_ReplyWithString(ctx, ext->rawString);
-      }
-      RedisModule_FreeString(ctx, ext->rawString);
-      RedisModule_Free(ext);
-    }
+  // the writes queued by the main thread are applied here rather than under the GIL. Docs
+  // that missed untracked writes are read again, a chunk at a time
+  if (idx != NULL && !NRIndex_Apply(idx, &mark)) {
+    NRIndex_Rebuild(idx, ctx, form.key);
+  }
+  if (idx != NULL) {
+    SearchIndex(ctx, idx, &form);
+    NRIndex_Release(idx);
   } else {
-    RedisModule_ReplyWithNull(ctx);
+    SearchScan(ctx, &form);
   }
 
-  Vector_Free(res);
-free_reply:
-  RedisModule_FreeCallReply(reply);
-free_argv:
+done:
+  // the entities of the query, all at once
+  ResetQueryArenas();
   FreeArgv(ctx, argv, argc);
   RedisModule_FreeThreadSafeContext(ctx);
   RedisModule_UnblockClient(bc, NULL);
   return NULL;
 }
 /*
-* nr.search <key> <text> <sort> [<filter> <value>]
+* nr.search <key> <text> <sort> <start> <end> [PRIORITY:HIGH|PRIORITY:LOW] [<filter> <value> ...]
 * Custom search search for hash set
+* Replies with a -BUSY error instead of queueing the search when MAX_QUEUED
+* searches are already waiting, or when it waited over MAX_QUEUE_AGE ms.
+* LOW priority searches, e.g. exports, only run when no HIGH priority one is
+* waiting, apart from a share of the workers' turns that keeps them moving.
+* Searches are HIGH priority by default. The priority is a single word right
+* before the filters, which come in pairs, so a filter field is never taken
+* for it whatever its name. A hash without an index is parsed by its first
+* search and kept in the parse cache for the next ones.
+* Replies with the number of matches followed by the docs of the page. When
+* the hash is scanned, with neither an index nor room in the parse cache, a
+* doc HSCAN returns twice while the hash is rehashing may be counted twice.
 */
 int HSearchCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-
   // check arguments
-  if (argc < 6 || argc % 2 != 0 || argc > 16) {
+  if (argc < 6 || argc > 17) {
     return RedisModule_WrongArity(ctx);
   }
 
+  int prio = TPOOL_PRIO_HIGH;
+  int option = argc % 2 == 1;
+  if (option) {
+    if (RMUtil_StringEqualsCaseC(argv[6], "PRIORITY:LOW")) {
+      prio = TPOOL_PRIO_LOW;
+    } else if (!RMUtil_StringEqualsCaseC(argv[6], "PRIORITY:HIGH")) {
+      return RedisModule_ReplyWithError(ctx, "ERR the word before the filters must be "
+                                             "PRIORITY:HIGH or PRIORITY:LOW");
+    }
+  }
+
+  // refuse right away rather than queue a search that will answer too late
+  if (nrConfig.maxQueued > 0 && tpool_queue_depth() >= nrConfig.maxQueued) {
+    return RedisModule_ReplyWithError(ctx, BUSY_QUEUE_FULL);
+  }
+
   RedisModuleBlockedClient *bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
 
-  // copy argv to use in thread
+  // copy argv to use in thread, without the option so the filters follow the page
   RedisModuleString **argvSafe = RedisModule_Alloc(sizeof(RedisModuleString *) * argc);
-  for (int i = 0; i < argc; i++) {
-    argvSafe[i] = RedisModule_CreateStringFromString(ctx, argv[i]);
+  for (int i = 0, j = 0; i < argc; i++) {
+    if (option && i == 6) continue;
+    argvSafe[j++] = RedisModule_CreateStringFromString(ctx, argv[i]);
   }
+  argc -= option;
 
   CommandCtx *cctx = RedisModule_Alloc(sizeof(CommandCtx));
   cctx->bc = bc;
   cctx->argv = argvSafe;
   cctx->argc = argc;
+  cctx->queuedAt = RedisModule_Milliseconds();
 
-  if (tpool_add_work(DoSearch, (void *)cctx) != 0) {
+  // the queue is full
+  if (tpool_add_work_prio(DoSearch, (void *)cctx, prio) != 0) {
     RedisModule_AbortBlock(bc);
-    RedisModule_ReplyWithError(ctx, "Sorry can't create a thread");
+    FreeArgv(ctx, argvSafe, argc);
+    RedisModule_Free(cctx);
+    RedisModule_ReplyWithError(ctx, BUSY_QUEUE_FULL);
+  }
+
+  return REDISMODULE_OK;
+}
+
+/*
+* nr.index <key> [TAG <field> ...] [SORTABLE <field> ...]
+* (Re)build the index of a hash from its current content. Searches on an
+* indexed hash use the pre-parsed documents instead of parsing HVALS. The
+* index follows later HSET/HDEL/DEL on the hash through keyspace events.
+* Filters on TAG fields are answered from a value -> doc ids index, which
+* suits low cardinality fields like department. Searches sorted by a
+* SORTABLE field read the docs in order instead of sorting the matches.
+* Indexes persist through RDB files only, as their schema. With AOF,
+* aof-use-rdb-preamble must be yes or a restart drops every index, the
+* searches then scan the hashes.
+*/
+int HIndexCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 2) {
+    return RedisModule_WrongArity(ctx);
+  }
+  if (argc > 2 && !RMUtil_StringEqualsCaseC(argv[2], "TAG") &&
+      !RMUtil_StringEqualsCaseC(argv[2], "SORTABLE")) {
+    return RedisModule_ReplyWithError(ctx, "ERR syntax error");
+  }
+
+  RedisModuleCallReply *reply = RedisModule_Call(ctx, "HGETALL", "s", argv[1]);
+  RMUTIL_ASSERT_NOERROR(ctx, reply);
+
+  // declare the schema first so loading the docs fills it in one pass
+  NRIndex *idx = NewNRIndex();
+  void (*addField)(NRIndex *, const char *, size_t) = NULL;
+  size_t len;
+  for (int i = 2; i < argc; i++) {
+    if (RMUtil_StringEqualsCaseC(argv[i], "TAG")) {
+      addField = NRIndex_AddTag;
+    } else if (RMUtil_StringEqualsCaseC(argv[i], "SORTABLE")) {
+      addField = NRIndex_AddSortable;
+    } else {
+      const char *field = RedisModule_StringPtrLen(argv[i], &len);
+      addField(idx, field, len);
+    }
+  }
+  NRIndex_LoadHashReply(idx, reply);
+  NRIndex_Set(ctx, argv[1], idx);
+  // searches read the index from now on
+  ParseCache_Invalidate(ctx, argv[1]);
+  RedisModule_FreeCallReply(reply);
+
+  RedisModule_ReplicateVerbatim(ctx);
+  return RedisModule_ReplyWithLongLong(ctx, idx->numDocs);
+}
+
+/*
+* nr.hset <key> <field> <value> [<field> <value> ...]
+* Set hash fields and update the index of the hash, if any, in the same step.
+* Replies with the number of fields that were added.
+*/
+int HSetCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 4 || argc % 2 != 0) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+  int type = RedisModule_KeyType(key);
+  if (type != REDISMODULE_KEYTYPE_EMPTY && type != REDISMODULE_KEYTYPE_HASH) {
+    RedisModule_CloseKey(key);
+    return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+  }
+
+  NRIndex *idx = NRIndex_Get(ctx, argv[1]);
+
+  long long added = 0;
+  int exists;
+  size_t flen, vlen;
+  for (int i = 2; i < argc; i += 2) {
+    exists = 0;
+    RedisModule_HashGet(key, REDISMODULE_HASH_EXISTS, argv[i], &exists, NULL);
+    RedisModule_HashSet(key, REDISMODULE_HASH_NONE, argv[i], argv[i + 1], NULL);
+    added += !exists;
+    const char *field = RedisModule_StringPtrLen(argv[i], &flen);
+    if (idx) {
+      const char *value = RedisModule_StringPtrLen(argv[i + 1], &vlen);
+      NRIndex_QueuePut(idx, field, flen, value, vlen);
+    } else {
+      ParseCache_MarkDirty(ctx, argv[1], field, flen);
+    }
+  }
+
+  if (idx) NRIndex_TryApply(idx);
+  RedisModule_CloseKey(key);
+
+  RedisModule_ReplicateVerbatim(ctx);
+  return RedisModule_ReplyWithLongLong(ctx, added);
+}
+
+/*
+* nr.hdel <key> <field> [<field> ...]
+* Delete hash fields and remove them from the index of the hash, if any.
+* Replies with the number of fields that were removed.
+*/
+int HDelCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 3) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  RedisModuleKey *key = RedisModule_OpenKey(ctx, argv[1], REDISMODULE_READ | REDISMODULE_WRITE);
+  int type = RedisModule_KeyType(key);
+  if (type != REDISMODULE_KEYTYPE_EMPTY && type != REDISMODULE_KEYTYPE_HASH) {
+    RedisModule_CloseKey(key);
+    return RedisModule_ReplyWithError(ctx, REDISMODULE_ERRORMSG_WRONGTYPE);
+  }
+
+  NRIndex *idx = NRIndex_Get(ctx, argv[1]);
+
+  long long deleted = 0;
+  size_t flen;
+  for (int i = 2; i < argc && type != REDISMODULE_KEYTYPE_EMPTY; i++) {
+    deleted += RedisModule_HashSet(key, REDISMODULE_HASH_NONE, argv[i], REDISMODULE_HASH_DELETE,
+                                   NULL);
+    const char *field = RedisModule_StringPtrLen(argv[i], &flen);
+    if (idx) {
+      NRIndex_QueueDelete(idx, field, flen);
+    } else {
+      ParseCache_MarkDirty(ctx, argv[1], field, flen);
+    }
   }
 
+  if (idx) NRIndex_TryApply(idx);
+  RedisModule_CloseKey(key);
+
+  RedisModule_ReplicateVerbatim(ctx);
+  return RedisModule_ReplyWithLongLong(ctx, deleted);
+}
+
+typedef struct {
+  char *name;
+  long long value;
+} NRMetric;
+
+#define NR_NUM_METRICS 9
+
+/* The metrics of NR.INFO and of the nr_search section of INFO */
+static void GetMetrics(NRMetric *metrics) {
+  ParseCacheStats cache;
+  ParseCache_GetStats(&cache);
+  NRMetric all[NR_NUM_METRICS] = {
+      {"string_pool_strings", sm_get_count(sm)},
+      {"string_pool_memory", sm_mem_usage(sm)},
+      {"workers", tpool_num_threads()},
+      {"queued_searches", tpool_queue_depth()},
+      {"parse_cache_hashes", cache.hashes},
+      {"parse_cache_memory", cache.memory},
+      {"parse_cache_hits", cache.hits},
+      {"parse_cache_misses", cache.misses},
+      {"parse_cache_evictions", cache.evictions},
+  };
+  memcpy(metrics, all, sizeof(all));
+}
+
+/*
+* nr.info
+* Reply with metrics of the module as name/value pairs: the strings interned
+* as JSON keys and the memory they take, the pool workers, the searches
+* waiting for one and the use of the parse cache.
+*/
+int NRInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 1) {
+    return RedisModule_WrongArity(ctx);
+  }
+  NRMetric metrics[NR_NUM_METRICS];
+  GetMetrics(metrics);
+  RedisModule_ReplyWithArray(ctx, NR_NUM_METRICS * 2);
+  for (int i = 0; i < NR_NUM_METRICS; i++) {
+    RedisModule_ReplyWithSimpleString(ctx, metrics[i].name);
+    RedisModule_ReplyWithLongLong(ctx, metrics[i].value);
+  }
   return REDISMODULE_OK;
 }
 
+/* The same metrics in INFO, so the usual monitoring picks them up */
+void NRInfoFunc(RedisModuleInfoCtx *ctx, int for_crash_report) {
+  NRMetric metrics[NR_NUM_METRICS];
+  GetMetrics(metrics);
+  RedisModule_InfoAddSection(ctx, "search");
+  for (int i = 0; i < NR_NUM_METRICS; i++) {
+    RedisModule_InfoAddFieldLongLong(ctx, metrics[i].name, metrics[i].value);
+  }
+}
+
 int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
-  int poolSize = 6;
-  if (tpool_create((int)poolSize) != 0) {
+  // Register the module itself
+  if (RedisModule_Init(ctx, "nr", 1, REDISMODULE_APIVER_1) == REDISMODULE_ERR) {
+    return REDISMODULE_ERR;
+  }
+
+  if (NRConfig_Load(ctx, argv, argc) == REDISMODULE_ERR) {
+    return REDISMODULE_ERR;
+  }
+  if (tpool_create((int)nrConfig.workers, (int)nrConfig.queueSize) != 0) {
     return REDISMODULE_ERR;
   }
 
@@ -257,14 +1130,39 @@ int RedisModule_OnLoad(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
   if(sm == NULL){
     return REDISMODULE_ERR;
   }
+  if (pthread_key_create(&queryArenasKey, FreeQueryArenas) != 0) {
+    return REDISMODULE_ERR;
+  }
 
-  // Register the module itself
-  if (RedisModule_Init(ctx, "nr", 1, REDISMODULE_APIVER_1) == REDISMODULE_ERR) {
+  if (NRIndex_RegisterType(ctx) == REDISMODULE_ERR) {
     return REDISMODULE_ERR;
   }
 
+  if (Keyspace_Subscribe(ctx) == REDISMODULE_ERR) {
+    RedisModule_Log(ctx, "warning",
+                    "keyspace notifications unavailable, indexes are only updated by "
+                    "NR.HSET/NR.HDEL and hashes without one are parsed by every search");
+  } else {
+    ParseCache_Init();
+  }
+
   // register NR.Search - using the shortened utility registration macro
   RMUtil_RegisterWriteCmd(ctx, "nr.search", HSearchCommand);
+  RMUtil_RegisterWriteCmd(ctx, "nr.index", HIndexCommand);
+  RMUtil_RegisterWriteCmd(ctx, "nr.hset", HSetCommand);
+  RMUtil_RegisterWriteCmd(ctx, "nr.hdel", HDelCommand);
+  if (RedisModule_CreateCommand(ctx, "nr.config", NRConfigCommand, "admin", 0, 0, 0) ==
+      REDISMODULE_ERR) {
+    return REDISMODULE_ERR;
+  }
+  if (RedisModule_CreateCommand(ctx, "nr.info", NRInfoCommand, "readonly", 0, 0, 0) ==
+      REDISMODULE_ERR) {
+    return REDISMODULE_ERR;
+  }
+  // INFO sections came with Redis 6, NR.INFO has the metrics before that
+  if (RedisModule_RegisterInfoFunc != NULL) {
+    RedisModule_RegisterInfoFunc(ctx, NRInfoFunc);
+  }
 
   return REDISMODULE_OK;
 }
@@ -0,0 +1,23 @@
+#include <dlfcn.h>
+#include <stdio.h>
+
+/*
+* Load the module the way Redis does, with every symbol bound at once, so a
+* dependency the link left undefined fails the build instead of MODULE LOAD.
+*/
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : "./module.so";
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+  if (dlsym(handle, "RedisModule_OnLoad") == NULL) {
+    fprintf(stderr, "%s has no RedisModule_OnLoad\n", path);
+    dlclose(handle);
+    return 1;
+  }
+  dlclose(handle);
+  printf("%s loads\n", path);
+  return 0;
+}
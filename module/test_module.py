@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+"""
+End to end tests of the module against a redis-server started with module.so
+loaded, run by make test_module. REDIS_SERVER names the redis-server binary,
+the one in the PATH by default, and REDIS_PORT the port it listens on. Redis 5
+or later is needed for the command filter that keeps indexes up to date. The
+tests talk RESP themselves, only the Python standard library is needed.
+"""
+import json
+import os
+import socket
+import subprocess
+import tempfile
+import time
+import unittest
+
+MODULE = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'module.so')
+SERVER = os.environ.get('REDIS_SERVER', 'redis-server')
+PORT = int(os.environ.get('REDIS_PORT', '6399'))
+
+
+class ReplyError(Exception):
+    pass
+
+
+class Client:
+    """Just enough RESP to send commands and read their replies"""
+
+    def __init__(self, port):
+        self.sock = socket.create_connection(('127.0.0.1', port))
+        self.reader = self.sock.makefile('rb')
+
+    def close(self):
+        self.reader.close()
+        self.sock.close()
+
+    def call(self, *args):
+        out = [b'*%d\r\n' % len(args)]
+        for arg in args:
+            arg = arg if isinstance(arg, bytes) else str(arg).encode()
+            out.append(b'$%d\r\n%s\r\n' % (len(arg), arg))
+        self.sock.sendall(b''.join(out))
+        return self.read()
+
+    def read(self):
+        line = self.reader.readline()[:-2]
+        kind, rest = line[:1], line[1:]
+        if kind == b'+':
+            return rest.decode()
+        if kind == b'-':
+            raise ReplyError(rest.decode())
+        if kind == b':':
+            return int(rest)
+        if kind == b'$':
+            n = int(rest)
+            if n < 0:
+                return None
+            data = self.reader.read(n + 2)[:-2]
+            return data.decode()
+        if kind == b'*':
+            n = int(rest)
+            return None if n < 0 else [self.read() for _ in range(n)]
+        raise ValueError('bad reply %r' % line)
+
+
+class ModuleTest(unittest.TestCase):
+    @classmethod
+    def setUpClass(cls):
+        cls.dir = tempfile.TemporaryDirectory()
+        cls.server = subprocess.Popen(
+            [SERVER, '--port', str(PORT), '--save', '', '--appendonly', 'no', '--dir',
+             cls.dir.name, '--loadmodule', MODULE],
+            stdout=subprocess.DEVNULL)
+        for _ in range(100):
+            try:
+                cls.r = Client(PORT)
+                cls.r.call('PING')
+                return
+            except (ConnectionError, OSError):
+                time.sleep(0.05)
+        raise RuntimeError('redis-server did not start')
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.r.close()
+        cls.server.terminate()
+        cls.server.wait()
+        cls.dir.cleanup()
+
+    def setUp(self):
+        self.r.call('FLUSHALL')
+
+    def put(self, key, docs):
+        for field, doc in docs.items():
+            self.r.call('HSET', key, field, json.dumps(doc))
+
+    def search(self, key, *args):
+        """Return the total and the docs of a search, sorted by name ascending"""
+        reply = self.r.call('NR.SEARCH', key, '', '-name', 0, 100, *args)
+        if reply is None:
+            return 0, []
+        return int(float(reply[0])), [json.loads(doc) for doc in reply[1:]]
+
+    def assertNames(self, result, names):
+        total, docs = result
+        self.assertEqual(total, len(names))
+        self.assertEqual([d['name'] for d in docs], names)
+
+    def testFilterOnPriorityField(self):
+        self.put('users', {'1': {'name': 'Ann', 'priority': 'high'},
+                           '2': {'name': 'Bob', 'priority': 'LOW'}})
+        self.assertNames(self.search('users', 'priority', 'high'), ['Ann'])
+        self.assertNames(self.search('users', 'priority', 'LOW'), ['Bob'])
+        self.assertNames(self.search('users', 'PRIORITY', 'LOW'), [])
+
+    def testPriorityOption(self):
+        self.put('users', {'1': {'name': 'Ann', 'priority': 'high'},
+                           '2': {'name': 'Bob', 'priority': 'LOW'}})
+        self.assertNames(self.search('users', 'PRIORITY:LOW'), ['Ann', 'Bob'])
+        self.assertNames(self.search('users', 'priority:high', 'priority', 'LOW'), ['Bob'])
+        with self.assertRaises(ReplyError):
+            self.search('users', 'priority')
+
+    def testNewKeyInCachedHash(self):
+        self.put('users', {'1': {'name': 'Ann'}})
+        self.assertNames(self.search('users', 'shift', 'night'), [])
+        # the cached docs are refreshed by the search, the key is new to all of them
+        self.put('users', {'2': {'name': 'Bob', 'shift': 'night'}})
+        self.assertNames(self.search('users', 'shift', 'night'), ['Bob'])
+
+    def testNewKeyInIndex(self):
+        self.put('users', {'1': {'name': 'Ann'}})
+        self.r.call('NR.INDEX', 'users')
+        self.assertNames(self.search('users', 'desk', 'D4'), [])
+        self.put('users', {'2': {'name': 'Bob', 'desk': 'D4'}})
+        self.assertNames(self.search('users', 'desk', 'D4'), ['Bob'])
+
+    def testIndexTouchesNoOtherKey(self):
+        self.put('users', {'1': {'name': 'Ann', 'department': 'Sales'}})
+        self.assertEqual(self.r.call('NR.INDEX', 'users', 'TAG', 'department'), 1)
+        self.assertEqual(self.r.call('KEYS', '*'), ['users'])
+        self.assertNames(self.search('users', 'department', 'Sales'), ['Ann'])
+
+    def testIndexAfterTransaction(self):
+        self.put('users', {'1': {'name': 'Ann'}})
+        self.r.call('NR.INDEX', 'users')
+        self.r.call('MULTI')
+        self.r.call('HSET', 'users', '2', json.dumps({'name': 'Bob'}))
+        self.r.call('HSET', 'users', '3', json.dumps({'name': 'Cid'}))
+        self.r.call('HDEL', 'users', '1')
+        self.r.call('EXEC')
+        self.assertNames(self.search('users'), ['Cid', 'Bob'])
+
+    def testIndexAfterFlush(self):
+        self.put('users', {'1': {'name': 'Ann'}, '2': {'name': 'Bob'}})
+        self.r.call('NR.INDEX', 'users')
+        self.r.call('FLUSHALL')
+        self.put('users', {'3': {'name': 'Cid'}})
+        self.assertNames(self.search('users'), ['Cid'])
+
+    def testIndexAfterFlushSameLength(self):
+        self.put('users', {'1': {'name': 'Ann'}, '2': {'name': 'Bob'}})
+        self.r.call('NR.INDEX', 'users')
+        self.r.call('FLUSHALL')
+        self.put('users', {'3': {'name': 'Cid'}, '4': {'name': 'Dan'}})
+        self.assertNames(self.search('users'), ['Dan', 'Cid'])
+
+    def testIndexAfterSwapDb(self):
+        self.put('users', {'1': {'name': 'Ann', 'department': 'Sales'}})
+        self.r.call('NR.INDEX', 'users', 'TAG', 'department')
+        self.r.call('SELECT', 1)
+        self.put('users', {'2': {'name': 'Bob', 'department': 'Sales'}})
+        try:
+            self.r.call('SWAPDB', 0, 1)
+            self.assertNames(self.search('users', 'department', 'Sales'), ['Ann'])
+            self.r.call('SELECT', 0)
+            self.assertNames(self.search('users', 'department', 'Sales'), ['Bob'])
+        finally:
+            self.r.call('SELECT', 0)
+
+    def testIndexAfterReload(self):
+        self.put('users', {'1': {'name': 'Ann', 'department': 'Sales'}})
+        self.r.call('NR.INDEX', 'users', 'TAG', 'department')
+        try:
+            self.r.call('DEBUG', 'RELOAD')
+        except ReplyError:
+            self.skipTest('DEBUG is disabled')
+        self.put('users', {'2': {'name': 'Bob', 'department': 'Sales'}})
+        self.assertNames(self.search('users', 'department', 'Sales'), ['Ann', 'Bob'])
+
+    def testInfoSection(self):
+        server = self.r.call('INFO', 'server')
+        version = server.split('redis_version:')[1].split('.')[0]
+        if int(version) < 6:
+            self.skipTest('INFO sections of modules need Redis 6')
+        self.put('users', {'1': {'name': 'Ann'}})
+        self.search('users')
+        self.search('users')
+        info = dict(line.split(':', 1) for line in self.r.call('INFO', 'nr_search').split('\r\n')
+                    if ':' in line)
+        self.assertEqual(info['nr_parse_cache_hashes'], '1')
+        self.assertEqual(info['nr_parse_cache_misses'], '1')
+        self.assertEqual(info['nr_parse_cache_hits'], '1')
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,72 @@
+#include "arena.h"
+
+static ArenaBlock *arena_newBlock(size_t size) {
+  ArenaBlock *b = malloc(sizeof(ArenaBlock) + size);
+  b->next = NULL;
+  b->size = size;
+  b->used = 0;
+  return b;
+}
+
+Arena *NewArena(size_t blockSize) {
+  Arena *a = malloc(sizeof(Arena));
+  a->blocks = NULL;
+  a->blockSize = blockSize;
+  a->allocated = 0;
+  return a;
+}
+
+void *Arena_Alloc(Arena *a, size_t size) {
+  size = (size + 15) & ~(size_t)15;
+  ArenaBlock *b = a->blocks;
+  if (b == NULL || b->used + size > b->size) {
+    if (size > a->blockSize / 4 && b != NULL) {
+      // a big allocation gets its own block behind the current one, which
+      // keeps filling up with the small ones
+      ArenaBlock *big = arena_newBlock(size);
+      big->next = b->next;
+      b->next = big;
+      big->used = size;
+      a->allocated += size;
+      return big->data;
+    }
+    b = arena_newBlock(size > a->blockSize ? size : a->blockSize);
+    b->next = a->blocks;
+    a->blocks = b;
+  }
+  void *ptr = b->data + b->used;
+  b->used += size;
+  a->allocated += size;
+  return ptr;
+}
+
+void Arena_Reset(Arena *a) {
+  ArenaBlock *keep = NULL, *b = a->blocks;
+  while (b) {
+    ArenaBlock *next = b->next;
+    if (keep == NULL && b->size == a->blockSize) {
+      keep = b;
+      keep->used = 0;
+      keep->next = NULL;
+    } else {
+      free(b);
+    }
+    b = next;
+  }
+  a->blocks = keep;
+  a->allocated = 0;
+}
+
+void Arena_Free(Arena *a) {
+  Arena_Reset(a);
+  free(a->blocks);
+  free(a);
+}
+
+size_t Arena_MemUsage(const Arena *a) {
+  size_t mem = sizeof(Arena);
+  for (ArenaBlock *b = a->blocks; b; b = b->next) {
+    mem += sizeof(ArenaBlock) + b->size;
+  }
+  return mem;
+}
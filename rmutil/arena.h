@@ -0,0 +1,38 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stdlib.h>
+
+/*
+* Bump allocator for objects sharing a lifetime, e.g. everything a query
+* allocates. Allocations are carved out of blocks of blockSize bytes, bigger
+* ones get a block of their own, and nothing is freed on its own: the whole
+* arena is reset at once. Not thread safe.
+*/
+typedef struct arenaBlock {
+  struct arenaBlock *next;
+  size_t size;
+  size_t used;
+  char data[] __attribute__((aligned(16)));
+} ArenaBlock;
+
+typedef struct {
+  ArenaBlock *blocks;  // the one being filled first
+  size_t blockSize;
+  size_t allocated;    // bytes handed out since the last reset
+} Arena;
+
+Arena *NewArena(size_t blockSize);
+
+/* Allocate size bytes aligned on 16 bytes, only released by Arena_Reset or Arena_Free */
+void *Arena_Alloc(Arena *a, size_t size);
+
+/* Release everything allocated so far. One block is kept for the next round */
+void Arena_Reset(Arena *a);
+
+void Arena_Free(Arena *a);
+
+/* Bytes held by the arena, used or not */
+size_t Arena_MemUsage(const Arena *a);
+
+#endif
@@ -0,0 +1,111 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "casestr.h"
+
+/*
+* Compare the substring kernels with the tolower loop they replace, on
+* haystacks shaped like the text fields of the user documents and like the
+* heaps of text columns.
+*/
+
+#define NUM_HAYS 1024
+#define ROUNDS 2000
+
+static const char *naive(const char *hay, size_t n, const char *needle, size_t m) {
+  if (n < m) return NULL;
+  const char *p1 = hay, *p2 = needle, *p1b;
+  size_t l = n - m + 1, c = m;
+  while (l--) {
+    p1b = p1;
+    while (c && tolower(*p1) == tolower(*p2)) {
+      c--;
+      p1++;
+      p2++;
+    }
+    if (c == 0) return p1b;
+    c = m;
+    p1 = p1b + 1;
+    p2 = needle;
+  }
+  return NULL;
+}
+
+typedef const char *(*finder)(const char *, size_t, const char *, size_t);
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *hays[NUM_HAYS];
+static size_t hayLens[NUM_HAYS];
+
+static void bench(const char *label, const char *needle, finder f) {
+  size_t m = strlen(needle), found = 0;
+  double start = now();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < NUM_HAYS; i++) {
+      found += f(hays[i], hayLens[i], needle, m) != NULL;
+    }
+  }
+  double ns = (now() - start) * 1e9 / ((double)ROUNDS * NUM_HAYS);
+  printf("  %-8s %-12s %6.2f ns/search (%zu found)\n", label, needle, ns, found);
+}
+
+static void run(const char *title, const char *fmt, const char **words, int numWords,
+                const char **needles, int numNeedles) {
+  char buf[128];
+  for (int i = 0; i < NUM_HAYS; i++) {
+    free(hays[i]);
+    hayLens[i] = snprintf(buf, sizeof(buf), fmt, words[i % numWords], i * 7919 % 100000);
+    hays[i] = malloc(hayLens[i]);
+    memcpy(hays[i], buf, hayLens[i]);
+  }
+  printf("%s\n", title);
+  for (int j = 0; j < numNeedles; j++) {
+    bench("tolower", needles[j], naive);
+    bench("scalar", needles[j], casestr_find_scalar);
+    bench("sse2", needles[j], casestr_find_sse2);
+    bench("find", needles[j], casestr_find);
+  }
+}
+
+/* Haystacks of about size bytes like the heap of a text column, values back to back and NUL
+ * separated */
+static void runHeaps(const char *title, size_t size, const char **words, int numWords,
+                     const char **needles, int numNeedles) {
+  for (int i = 0; i < NUM_HAYS; i++) {
+    free(hays[i]);
+    hays[i] = malloc(size + 64);
+    hayLens[i] = 0;
+    for (int w = i; hayLens[i] < size; w++) {
+      hayLens[i] += sprintf(hays[i] + hayLens[i], "%s", words[w % numWords]) + 1;
+    }
+  }
+  printf("%s\n", title);
+  for (int j = 0; j < numNeedles; j++) {
+    bench("sse2", needles[j], casestr_find_sse2);
+    bench("find", needles[j], casestr_find);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *names[] = {"User", "Alexandra Johnson", "Bob", "Maria Rodriguez-Garcia"};
+  const char *depts[] = {"Sales", "Engineering", "HR", "Support", "Legal"};
+  const char *nameNeedles[] = {"user 0", "garcia", "xyz"};
+  const char *deptNeedles[] = {"eng", "support", "qq"};
+  const char *longNeedles[] = {"engineering", "zzz"};
+
+  printf("find is casestr_find, which uses %s for long haystacks\n", casestr_impl());
+  run("names", "%s %05d", names, 4, nameNeedles, 3);
+  run("departments", "%s", depts, 5, deptNeedles, 3);
+  run("long values", "%s team based in the north east region, office %05d", depts, 5,
+      longNeedles, 2);
+  runHeaps("column heaps, 256 bytes", 256, depts, 5, longNeedles + 1, 1);
+  runHeaps("column heaps, 4 KB", 4096, depts, 5, longNeedles + 1, 1);
+  return 0;
+}
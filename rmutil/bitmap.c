@@ -0,0 +1,340 @@
+#include <string.h>
+#include "bitmap.h"
+
+#define BITSET_WORDS (65536 / 64)
+
+/* Bits set in x. __builtin_popcountll is a libgcc call without -mpopcnt, which the module is not
+ * linked against */
+static inline uint32_t popcount64(uint64_t x) {
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (x * 0x0101010101010101ULL) >> 56;
+}
+
+/* Position of key in the sorted container list, or where it would be inserted */
+static uint32_t bitmap_findContainer(const Bitmap *bm, uint16_t key, int *found) {
+  uint32_t lo = 0, hi = bm->size;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (bm->containers[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *found = lo < bm->size && bm->containers[lo].key == key;
+  return lo;
+}
+
+/* Position of val in a sorted array, or where it would be inserted */
+static uint32_t array_find(const uint16_t *arr, uint32_t n, uint16_t val, int *found) {
+  uint32_t lo = 0, hi = n;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (arr[mid] < val) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *found = lo < n && arr[lo] == val;
+  return lo;
+}
+
+static void container_toBitset(BitmapContainer *c) {
+  uint64_t *bits = calloc(BITSET_WORDS, sizeof(uint64_t));
+  for (uint32_t i = 0; i < c->card; i++) {
+    bits[c->array[i] >> 6] |= 1ULL << (c->array[i] & 63);
+  }
+  free(c->array);
+  c->bits = bits;
+  c->type = BITMAP_CONTAINER_BITSET;
+  c->cap = 0;
+}
+
+static void container_toArray(BitmapContainer *c) {
+  uint16_t *arr = malloc(c->card * sizeof(uint16_t));
+  uint32_t n = 0;
+  for (uint32_t w = 0; w < BITSET_WORDS; w++) {
+    uint64_t word = c->bits[w];
+    while (word) {
+      arr[n++] = (w << 6) + __builtin_ctzll(word);
+      word &= word - 1;
+    }
+  }
+  free(c->bits);
+  c->array = arr;
+  c->cap = c->card;
+  c->type = BITMAP_CONTAINER_ARRAY;
+}
+
+static void container_free(BitmapContainer *c) {
+  if (c->type == BITMAP_CONTAINER_ARRAY) {
+    free(c->array);
+  } else {
+    free(c->bits);
+  }
+}
+
+/* Intersect two containers into out, returns the cardinality of the result */
+static uint32_t container_and(const BitmapContainer *a, const BitmapContainer *b,
+                              BitmapContainer *out) {
+  out->key = a->key;
+  if (a->type == BITMAP_CONTAINER_BITSET && b->type == BITMAP_CONTAINER_BITSET) {
+    uint64_t *bits = malloc(BITSET_WORDS * sizeof(uint64_t));
+    uint32_t card = 0;
+    for (uint32_t w = 0; w < BITSET_WORDS; w++) {
+      bits[w] = a->bits[w] & b->bits[w];
+      card += popcount64(bits[w]);
+    }
+    out->type = BITMAP_CONTAINER_BITSET;
+    out->bits = bits;
+    out->card = card;
+    out->cap = 0;
+    if (card <= BITMAP_ARRAY_MAX) container_toArray(out);
+    return card;
+  }
+
+  // at least one side is an array, the result is never larger than it
+  if (a->type == BITMAP_CONTAINER_BITSET) {
+    const BitmapContainer *t = a;
+    a = b;
+    b = t;
+  }
+  uint16_t *arr = malloc((a->card ? a->card : 1) * sizeof(uint16_t));
+  uint32_t n = 0;
+  if (b->type == BITMAP_CONTAINER_BITSET) {
+    for (uint32_t i = 0; i < a->card; i++) {
+      uint16_t v = a->array[i];
+      if (b->bits[v >> 6] & (1ULL << (v & 63))) arr[n++] = v;
+    }
+  } else {
+    uint32_t i = 0, j = 0;
+    while (i < a->card && j < b->card) {
+      if (a->array[i] < b->array[j]) {
+        i++;
+      } else if (a->array[i] > b->array[j]) {
+        j++;
+      } else {
+        arr[n++] = a->array[i];
+        i++;
+        j++;
+      }
+    }
+  }
+  out->type = BITMAP_CONTAINER_ARRAY;
+  out->array = arr;
+  out->card = n;
+  out->cap = a->card ? a->card : 1;
+  return n;
+}
+
+Bitmap *NewBitmap() {
+  return calloc(1, sizeof(Bitmap));
+}
+
+void Bitmap_Free(Bitmap *bm) {
+  for (uint32_t i = 0; i < bm->size; i++) {
+    container_free(&bm->containers[i]);
+  }
+  free(bm->containers);
+  free(bm);
+}
+
+int Bitmap_Add(Bitmap *bm, uint32_t val) {
+  int found;
+  uint16_t key = val >> 16, low = val & 0xFFFF;
+  uint32_t ci = bitmap_findContainer(bm, key, &found);
+  if (!found) {
+    if (bm->size == bm->cap) {
+      bm->cap = bm->cap ? bm->cap * 2 : 1;
+      bm->containers = realloc(bm->containers, bm->cap * sizeof(BitmapContainer));
+    }
+    memmove(&bm->containers[ci + 1], &bm->containers[ci],
+            (bm->size - ci) * sizeof(BitmapContainer));
+    bm->size++;
+    BitmapContainer *c = &bm->containers[ci];
+    c->key = key;
+    c->type = BITMAP_CONTAINER_ARRAY;
+    c->card = 0;
+    c->cap = 4;
+    c->array = malloc(c->cap * sizeof(uint16_t));
+  }
+
+  BitmapContainer *c = &bm->containers[ci];
+  if (c->type == BITMAP_CONTAINER_BITSET) {
+    uint64_t mask = 1ULL << (low & 63);
+    if (c->bits[low >> 6] & mask) return 0;
+    c->bits[low >> 6] |= mask;
+    c->card++;
+    return 1;
+  }
+
+  uint32_t pos = array_find(c->array, c->card, low, &found);
+  if (found) return 0;
+  if (c->card == BITMAP_ARRAY_MAX) {
+    container_toBitset(c);
+    c->bits[low >> 6] |= 1ULL << (low & 63);
+    c->card++;
+    return 1;
+  }
+  if (c->card == c->cap) {
+    c->cap = c->cap * 2 > BITMAP_ARRAY_MAX ? BITMAP_ARRAY_MAX : c->cap * 2;
+    c->array = realloc(c->array, c->cap * sizeof(uint16_t));
+  }
+  memmove(&c->array[pos + 1], &c->array[pos], (c->card - pos) * sizeof(uint16_t));
+  c->array[pos] = low;
+  c->card++;
+  return 1;
+}
+
+int Bitmap_Remove(Bitmap *bm, uint32_t val) {
+  int found;
+  uint16_t key = val >> 16, low = val & 0xFFFF;
+  uint32_t ci = bitmap_findContainer(bm, key, &found);
+  if (!found) return 0;
+
+  BitmapContainer *c = &bm->containers[ci];
+  if (c->type == BITMAP_CONTAINER_BITSET) {
+    uint64_t mask = 1ULL << (low & 63);
+    if (!(c->bits[low >> 6] & mask)) return 0;
+    c->bits[low >> 6] &= ~mask;
+    c->card--;
+    // convert back a little below the limit so we don't flip back and forth
+    if (c->card < BITMAP_ARRAY_MAX / 2) container_toArray(c);
+    return 1;
+  }
+
+  uint32_t pos = array_find(c->array, c->card, low, &found);
+  if (!found) return 0;
+  memmove(&c->array[pos], &c->array[pos + 1], (c->card - pos - 1) * sizeof(uint16_t));
+  c->card--;
+
+  if (c->card == 0) {
+    container_free(c);
+    memmove(&bm->containers[ci], &bm->containers[ci + 1],
+            (bm->size - ci - 1) * sizeof(BitmapContainer));
+    bm->size--;
+  }
+  return 1;
+}
+
+int Bitmap_Contains(const Bitmap *bm, uint32_t val) {
+  int found;
+  uint16_t low = val & 0xFFFF;
+  uint32_t ci = bitmap_findContainer(bm, val >> 16, &found);
+  if (!found) return 0;
+
+  const BitmapContainer *c = &bm->containers[ci];
+  if (c->type == BITMAP_CONTAINER_BITSET) {
+    return (c->bits[low >> 6] >> (low & 63)) & 1;
+  }
+  array_find(c->array, c->card, low, &found);
+  return found;
+}
+
+uint64_t Bitmap_Cardinality(const Bitmap *bm) {
+  uint64_t card = 0;
+  for (uint32_t i = 0; i < bm->size; i++) {
+    card += bm->containers[i].card;
+  }
+  return card;
+}
+
+Bitmap *Bitmap_And(const Bitmap *a, const Bitmap *b) {
+  Bitmap *res = NewBitmap();
+  uint32_t i = 0, j = 0;
+  while (i < a->size && j < b->size) {
+    const BitmapContainer *ca = &a->containers[i], *cb = &b->containers[j];
+    if (ca->key < cb->key) {
+      i++;
+    } else if (ca->key > cb->key) {
+      j++;
+    } else {
+      BitmapContainer out;
+      if (container_and(ca, cb, &out) == 0) {
+        container_free(&out);
+      } else {
+        if (res->size == res->cap) {
+          res->cap = res->cap ? res->cap * 2 : 1;
+          res->containers = realloc(res->containers, res->cap * sizeof(BitmapContainer));
+        }
+        res->containers[res->size++] = out;
+      }
+      i++;
+      j++;
+    }
+  }
+  return res;
+}
+
+void Bitmap_AndInPlace(Bitmap *bm, const Bitmap *other) {
+  Bitmap *res = Bitmap_And(bm, other);
+  for (uint32_t i = 0; i < bm->size; i++) {
+    container_free(&bm->containers[i]);
+  }
+  free(bm->containers);
+  *bm = *res;
+  free(res);
+}
+
+Bitmap *Bitmap_Copy(const Bitmap *bm) {
+  Bitmap *res = NewBitmap();
+  res->size = res->cap = bm->size;
+  res->containers = malloc((bm->size ? bm->size : 1) * sizeof(BitmapContainer));
+  for (uint32_t i = 0; i < bm->size; i++) {
+    const BitmapContainer *c = &bm->containers[i];
+    BitmapContainer *o = &res->containers[i];
+    *o = *c;
+    if (c->type == BITMAP_CONTAINER_BITSET) {
+      o->bits = malloc(BITSET_WORDS * sizeof(uint64_t));
+      memcpy(o->bits, c->bits, BITSET_WORDS * sizeof(uint64_t));
+    } else {
+      o->cap = c->card ? c->card : 1;
+      o->array = malloc(o->cap * sizeof(uint16_t));
+      memcpy(o->array, c->array, c->card * sizeof(uint16_t));
+    }
+  }
+  return res;
+}
+
+size_t Bitmap_MemUsage(const Bitmap *bm) {
+  size_t mem = sizeof(Bitmap) + bm->cap * sizeof(BitmapContainer);
+  for (uint32_t i = 0; i < bm->size; i++) {
+    const BitmapContainer *c = &bm->containers[i];
+    mem += c->type == BITMAP_CONTAINER_BITSET ? BITSET_WORDS * sizeof(uint64_t)
+                                              : c->cap * sizeof(uint16_t);
+  }
+  return mem;
+}
+
+BitmapIterator Bitmap_Iterate(const Bitmap *bm) {
+  BitmapIterator it = {.bm = bm, .container = 0, .pos = 0};
+  return it;
+}
+
+int BitmapIterator_Next(BitmapIterator *it, uint32_t *val) {
+  while (it->container < it->bm->size) {
+    const BitmapContainer *c = &it->bm->containers[it->container];
+    if (c->type == BITMAP_CONTAINER_ARRAY) {
+      if (it->pos < c->card) {
+        *val = ((uint32_t)c->key << 16) | c->array[it->pos++];
+        return 1;
+      }
+    } else {
+      while (it->pos < 65536) {
+        uint64_t word = c->bits[it->pos >> 6] >> (it->pos & 63);
+        if (word) {
+          it->pos += __builtin_ctzll(word);
+          *val = ((uint32_t)c->key << 16) | it->pos++;
+          return 1;
+        }
+        it->pos = (it->pos | 63) + 1;
+      }
+    }
+    it->container++;
+    it->pos = 0;
+  }
+  return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef __BITMAP_H__
+#define __BITMAP_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+* Compressed bitmap of 32 bit integers, in the spirit of roaring bitmaps.
+* Values are grouped by their high 16 bits into containers. A container
+* holds a sorted array of the low 16 bits while it is sparse, and switches
+* to a plain 8KB bitset once it has more than BITMAP_ARRAY_MAX members.
+*/
+#define BITMAP_ARRAY_MAX 4096
+
+#define BITMAP_CONTAINER_ARRAY 0
+#define BITMAP_CONTAINER_BITSET 1
+
+typedef struct {
+  uint16_t key;
+  uint16_t type;
+  uint32_t card;
+  uint32_t cap;  // capacity of array, in elements
+  union {
+    uint16_t *array;
+    uint64_t *bits;
+  };
+} BitmapContainer;
+
+typedef struct {
+  BitmapContainer *containers;  // sorted by key
+  uint32_t size;
+  uint32_t cap;
+} Bitmap;
+
+typedef struct {
+  const Bitmap *bm;
+  uint32_t container;
+  uint32_t pos;  // index in the array, or bit number in the bitset
+} BitmapIterator;
+
+Bitmap *NewBitmap();
+
+void Bitmap_Free(Bitmap *bm);
+
+/* Add a value, returns 1 if it was not in the bitmap */
+int Bitmap_Add(Bitmap *bm, uint32_t val);
+
+/* Remove a value, returns 1 if it was in the bitmap */
+int Bitmap_Remove(Bitmap *bm, uint32_t val);
+
+int Bitmap_Contains(const Bitmap *bm, uint32_t val);
+
+uint64_t Bitmap_Cardinality(const Bitmap *bm);
+
+/* Return a new bitmap with the values in both a and b */
+Bitmap *Bitmap_And(const Bitmap *a, const Bitmap *b);
+
+/* Keep only the values of bm that are also in other */
+void Bitmap_AndInPlace(Bitmap *bm, const Bitmap *other);
+
+Bitmap *Bitmap_Copy(const Bitmap *bm);
+
+/* Approximate number of bytes used by the bitmap */
+size_t Bitmap_MemUsage(const Bitmap *bm);
+
+/* Iterate the values in ascending order.
+ * e.g.
+ *  BitmapIterator it = Bitmap_Iterate(bm);
+ *  uint32_t v;
+ *  while (BitmapIterator_Next(&it, &v)) { ... }
+ */
+BitmapIterator Bitmap_Iterate(const Bitmap *bm);
+
+int BitmapIterator_Next(BitmapIterator *it, uint32_t *val);
+
+#endif
@@ -24,6 +24,7 @@
 /* JSON parser in C. */
 
 #include <string.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
@@ -32,6 +33,7 @@
 #include <ctype.h>
 #include "cJSON.h"
 #include "string_pool.h"
+#include "json_structural.h"
 
 extern StringPool *sm;
 static const char *ep;
@@ -284,8 +286,6 @@ static const char *parse_string(cJSON *item, const char *str, int forKey) {
     return ptr;
   }
 
-  item->valueint=-len;
-
   out = (char *)cJSON_malloc(len + 1); /* This is how long we need for the string, roughly. */
   if (!out) return 0;
 
@@ -314,6 +314,11 @@ static const char *parse_string(cJSON *item, const char *str, int forKey) {
           break;
         case 'u': /* transcode utf16 to utf8. */
           uc = parse_hex4(ptr + 1);
+          if (uc == 0 && strncmp(ptr + 1, "0000", 4)) { /* not 4 hex digits, don't skip the end. */
+            cJSON_free(out);
+            ep = str;
+            return 0;
+          }
           ptr += 4; /* get the unicode char. */
 
           if ((uc >= 0xDC00 && uc <= 0xDFFF) || uc == 0) break; /* check for invalid.	*/
@@ -322,8 +327,8 @@ static const char *parse_string(cJSON *item, const char *str, int forKey) {
           {
             if (ptr[1] != '\\' || ptr[2] != 'u') break; /* missing second-half of surrogate.	*/
             uc2 = parse_hex4(ptr + 3);
-            ptr += 6;
             if (uc2 < 0xDC00 || uc2 > 0xDFFF) break; /* invalid second-half of surrogate.	*/
+            ptr += 6;
             uc = 0x10000 + (((uc & 0x3FF) << 10) | (uc2 & 0x3FF));
           }
 
@@ -360,8 +365,19 @@ static const char *parse_string(cJSON *item, const char *str, int forKey) {
   }
   *ptr2 = 0;
   if (*ptr == '\"') ptr++;
-  item->valuestring = out;
   item->type = cJSON_String;
+  // len was only an upper bound, keep the decoded length so the string can be
+  // compared without strlen. An empty result can't be told apart by its sign,
+  // it is the shared empty string, which is never freed nor written.
+  if (ptr2 == out) {
+    static char emptyString[1] = "";
+    cJSON_free(out);
+    item->valueint = 0;
+    item->valuestring = emptyString;
+    return ptr;
+  }
+  item->valueint = -(int)(ptr2 - out);
+  item->valuestring = out;
   return ptr;
 }
 
@@ -505,6 +521,383 @@ cJSON *cJSON_Parse(const char *value) {
   return cJSON_ParseWithOpts(value, 0, 0);
 }
 
+/* Jump over a key the way parse_string reads it, escapes aren't supported on keys. */
+static const char *skip_key(const char *str, size_t *len) {
+  const char *ptr = str + 1;
+  while (*ptr != '\"' && *ptr) ptr++;
+  *len = ptr - str - 1;
+  if (*ptr == '\"') ptr++;
+  return ptr;
+}
+
+/* Jump over a string value without unescaping it. */
+static const char *skip_string(const char *str) {
+  const char *ptr = str + 1;
+  while (*ptr != '\"' && *ptr)
+    if (*ptr++ == '\\' && *ptr) ptr++; /* Skip escaped quotes. */
+  if (*ptr == '\"') ptr++;
+  return ptr;
+}
+
+/* Jump over a value, accepting what parse_value accepts but building nothing. */
+static const char *skip_value(const char *value) {
+  cJSON number;
+  char close;
+  size_t len;
+  if (!value) return 0;
+  if (!strncmp(value, "null", 4)) return value + 4;
+  if (!strncmp(value, "false", 5)) return value + 5;
+  if (!strncmp(value, "true", 4)) return value + 4;
+  if (*value == '\"') return skip_string(value);
+  if (*value == '-' || (*value >= '0' && *value <= '9')) return parse_number(&number, value);
+  if (*value != '[' && *value != '{') {
+    ep = value;
+    return 0;
+  }
+
+  close = *value == '[' ? ']' : '}';
+  value = skip(value + 1);
+  if (*value == close) return value + 1;
+  while (1) {
+    if (close == '}') {
+      if (*value != '\"') {
+        ep = value;
+        return 0;
+      }
+      value = skip(skip_key(value, &len));
+      if (*value != ':') {
+        ep = value;
+        return 0;
+      }
+      value = skip(value + 1);
+    }
+    value = skip(skip_value(value));
+    if (!value) return 0;
+    if (*value != ',') break;
+    value = skip(value + 1);
+  }
+  if (*value == close) return value + 1;
+  ep = value;
+  return 0;
+}
+
+const char *cJSON_Extract(const char *value, const char **keys, const size_t *keyLens, int n,
+                          cJSON *items) {
+  const char *key;
+  size_t keyLen;
+  int i;
+  ep = 0;
+  for (i = 0; i < n; i++) {
+    memset(&items[i], 0, sizeof(cJSON));
+    items[i].type = cJSON_NULL;
+  }
+
+  value = skip(value);
+  if (!value) return 0;
+  if (*value != '{') return skip_value(value);
+  value = skip(value + 1);
+  if (*value == '}') return value + 1;
+
+  while (1) {
+    if (*value != '\"') {
+      ep = value;
+      goto fail;
+    }
+    key = value + 1;
+    value = skip(skip_key(value, &keyLen));
+    if (*value != ':') {
+      ep = value;
+      goto fail;
+    }
+    value = skip(value + 1);
+
+    /* like cJSON_GetObjectItem, the first occurrence of a key wins */
+    for (i = 0; i < n; i++) {
+      if (!items[i].string && keyLens[i] == keyLen && !memcmp(keys[i], key, keyLen)) break;
+    }
+    if (i < n) {
+      items[i].string = (char *)keys[i];
+      value = *value == '\"' ? parse_string(&items[i], value, 0) : skip_value(value);
+    } else {
+      value = skip_value(value);
+    }
+    value = skip(value);
+    if (!value) goto fail;
+    if (*value == '}') return value + 1;
+    if (*value != ',') {
+      ep = value;
+      goto fail;
+    }
+    value = skip(value + 1);
+  }
+
+fail:
+  cJSON_FreeExtracted(items, n);
+  return 0;
+}
+
+void cJSON_FreeExtracted(cJSON *items, int n) {
+  for (int i = 0; i < n; i++) {
+    if (items[i].type == cJSON_String && items[i].valueint < 0) cJSON_free(items[i].valuestring);
+    items[i].type = cJSON_NULL;
+    items[i].valuestring = 0;
+  }
+}
+
+/* Append an escaped string value to the unescaped copies of the tape. */
+static int tape_unescape(cJSON_Tape **tape, unsigned *cap, const char *value, const char **end,
+                         cJSON_TapeEntry *entry) {
+  cJSON item;
+  size_t len;
+  char *copies;
+  memset(&item, 0, sizeof(cJSON));
+  *end = parse_string(&item, value, 0);
+  if (!*end) return -1;
+  /* an escape that decodes to nothing gives the shared empty string, nothing to free */
+  len = -item.valueint;
+  if ((*tape)->unescapedLen + len + 1 > *cap) {
+    *cap = (*cap + len + 1) * 2;
+    copies = (char *)cJSON_malloc(*cap);
+    if (!copies) {
+      if (len) cJSON_free(item.valuestring);
+      return -1;
+    }
+    if ((*tape)->unescaped) {
+      memcpy(copies, (*tape)->unescaped, (*tape)->unescapedLen);
+      cJSON_free((*tape)->unescaped);
+    }
+    (*tape)->unescaped = copies;
+  }
+  memcpy((*tape)->unescaped + (*tape)->unescapedLen, item.valuestring, len);
+  (*tape)->unescaped[(*tape)->unescapedLen + len] = '\0';
+  if (len) cJSON_free(item.valuestring);
+  entry->offset = (*tape)->unescapedLen;
+  entry->len = len;
+  entry->type |= cJSON_TapeUnescaped;
+  (*tape)->unescapedLen += len + 1;
+  return 0;
+}
+
+/* Type of the value starting with c, once skip_value accepted it. */
+static int tape_type(char c) {
+  switch (c) {
+    case 'n':
+      return cJSON_NULL;
+    case 'f':
+      return cJSON_False;
+    case 't':
+      return cJSON_True;
+    case '[':
+      return cJSON_Array;
+    case '{':
+      return cJSON_Object;
+    default:
+      return cJSON_Number;
+  }
+}
+
+static cJSON_Tape *tape_grow(cJSON_Tape *tape, int cap) {
+  cJSON_Tape *grown;
+  grown = (cJSON_Tape *)cJSON_malloc(sizeof(cJSON_Tape) + cap * sizeof(cJSON_TapeEntry));
+  if (!grown) return 0;
+  memcpy(grown, tape, sizeof(cJSON_Tape) + tape->size * sizeof(cJSON_TapeEntry));
+  cJSON_free(tape);
+  return grown;
+}
+
+static cJSON_Tape *tape_new(const char *doc, int cap) {
+  cJSON_Tape *tape;
+  tape = (cJSON_Tape *)cJSON_malloc(sizeof(cJSON_Tape) + cap * sizeof(cJSON_TapeEntry));
+  if (!tape) return 0;
+  tape->doc = doc;
+  tape->unescaped = 0;
+  tape->unescapedLen = 0;
+  tape->size = 0;
+  return tape;
+}
+
+cJSON_Tape *cJSON_ParseTape(const char *value) {
+  const char *doc = value, *end;
+  unsigned unescapedCap = 0;
+  int cap = 8;
+  cJSON_Tape *tape, *grown;
+  cJSON key;
+  ep = 0;
+
+  tape = tape_new(doc, cap);
+  if (!tape) return 0;
+
+  value = skip(value);
+  if (!value) goto fail;
+  if (*value != '{') {
+    /* valid JSON that isn't an object has no members */
+    if (!skip_value(value)) goto fail;
+    return tape;
+  }
+  value = skip(value + 1);
+  if (*value == '}') return tape;
+
+  while (1) {
+    cJSON_TapeEntry *entry;
+    if (*value != '\"') {
+      ep = value;
+      goto fail;
+    }
+    value = skip(parse_string(&key, value, 1));
+    if (*value != ':') {
+      ep = value;
+      goto fail;
+    }
+    value = skip(value + 1);
+
+    if (tape->size == cap) {
+      cap *= 2;
+      if (!(grown = tape_grow(tape, cap))) goto fail;
+      tape = grown;
+    }
+    entry = &tape->entries[tape->size];
+    entry->key = key.valuestring;
+    if (*value == '\"') {
+      const char *ptr = value + 1;
+      int hasEscape = 0;
+      while (*ptr != '\"' && *ptr)
+        if (*ptr++ == '\\' && *ptr) {
+          ptr++; /* Skip escaped quotes. */
+          hasEscape = 1;
+        }
+      entry->type = cJSON_String;
+      entry->offset = value + 1 - doc;
+      entry->len = ptr - value - 1;
+      end = *ptr == '\"' ? ptr + 1 : ptr;
+      if (hasEscape && tape_unescape(&tape, &unescapedCap, value, &end, entry) != 0) goto fail;
+    } else {
+      end = skip_value(value);
+      if (!end) goto fail;
+      entry->type = tape_type(*value);
+      entry->offset = value - doc;
+      entry->len = end - value;
+    }
+    tape->size++;
+
+    value = skip(end);
+    if (*value == '}') break;
+    if (*value != ',') {
+      ep = value;
+      goto fail;
+    }
+    value = skip(value + 1);
+  }
+
+  /* give back the unused entries */
+  if (tape->size < cap && (grown = tape_grow(tape, tape->size))) tape = grown;
+  return tape;
+
+fail:
+  cJSON_DeleteTape(tape);
+  return 0;
+}
+
+/* Second stage of cJSON_ParseTapeLen: build the tape of an object from the positions of its
+ * structurals, checking that only whitespace separates them from the values in between. Strings
+ * are known to have escapes from the backslashes between their quotes. Anything this doesn't
+ * handle the way cJSON_ParseTape does, like escapes in keys, returns 0 and is left to
+ * cJSON_ParseTape. */
+static cJSON_Tape *tape_from_structurals(const char *doc, const uint32_t *pos, size_t n) {
+  const char *value = skip(doc), *key, *close, *end;
+  unsigned unescapedCap = 0;
+  int cap = 8;
+  size_t i = 1;
+  cJSON_Tape *tape, *grown;
+
+  if (n == 0 || *value != '{' || doc + pos[0] != value) return 0;
+  tape = tape_new(doc, cap);
+  if (!tape) return 0;
+  if (n > 1 && doc[pos[1]] == '}' && skip(value + 1) == doc + pos[1]) return tape;
+
+  while (1) {
+    cJSON_TapeEntry *entry;
+    /* "key" : */
+    if (i + 2 >= n) goto fallback;
+    key = doc + pos[i];
+    close = doc + pos[i + 1];
+    /* a backslash in the key comes before its closing quote */
+    if (*key != '\"' || key != skip(value + 1) || *close != '\"') goto fallback;
+    if (doc[pos[i + 2]] != ':' || skip(close + 1) != doc + pos[i + 2]) goto fallback;
+    value = skip(doc + pos[i + 2] + 1);
+    i += 3;
+
+    if (tape->size == cap) {
+      cap *= 2;
+      if (!(grown = tape_grow(tape, cap))) goto fallback;
+      tape = grown;
+    }
+    entry = &tape->entries[tape->size];
+    entry->key = sm_nput(sm, key + 1, close - key - 1);
+    if (*value == '\"') {
+      int hasEscape = 0;
+      if (doc + pos[i++] != value) goto fallback;
+      while (i < n && doc[pos[i]] == '\\') hasEscape = ++i;
+      if (i >= n) goto fallback;
+      close = doc + pos[i++];
+      entry->type = cJSON_String;
+      entry->offset = value + 1 - doc;
+      entry->len = close - value - 1;
+      end = close + 1;
+      if (hasEscape) {
+        if (tape_unescape(&tape, &unescapedCap, value, &end, entry) != 0 || end != close + 1)
+          goto fallback;
+      }
+    } else {
+      end = skip_value(value);
+      if (!end) goto fallback;
+      entry->type = tape_type(*value);
+      entry->offset = value - doc;
+      entry->len = end - value;
+      /* the structurals of arrays and objects */
+      while (i < n && doc + pos[i] < end) i++;
+    }
+    tape->size++;
+
+    /* , or the closing } */
+    if (i >= n || skip(end) != doc + pos[i]) goto fallback;
+    if (doc[pos[i]] == '}') break;
+    if (doc[pos[i]] != ',') goto fallback;
+    value = doc + pos[i++];
+  }
+
+  if (tape->size < cap && (grown = tape_grow(tape, tape->size))) tape = grown;
+  return tape;
+
+fallback:
+  cJSON_DeleteTape(tape);
+  return 0;
+}
+
+cJSON_Tape *cJSON_ParseTapeLen(const char *value, size_t len) {
+  uint32_t stackPos[256], *pos = stackPos;
+  cJSON_Tape *tape = 0;
+  size_t n;
+
+  if (len > sizeof(stackPos) / sizeof(stackPos[0])) {
+    pos = (uint32_t *)cJSON_malloc(len * sizeof(uint32_t));
+    if (!pos) return 0;
+  }
+  n = json_structurals(value, len, pos);
+  if (n != JSON_STRUCTURAL_NUL) tape = tape_from_structurals(value, pos, n);
+  if (pos != stackPos) cJSON_free(pos);
+  return tape ? tape : cJSON_ParseTape(value);
+}
+
+void cJSON_DeleteTape(cJSON_Tape *tape) {
+  if (!tape) return;
+  if (tape->unescaped) cJSON_free(tape->unescaped);
+  cJSON_free(tape);
+}
+
+size_t cJSON_TapeMemUsage(const cJSON_Tape *tape) {
+  return sizeof(cJSON_Tape) + tape->size * sizeof(cJSON_TapeEntry) + tape->unescapedLen;
+}
+
 /* Render a cJSON item/entity/structure to text. */
 char *cJSON_Print(cJSON *item) {
   return print_value(item, 0, 1, 0);
@@ -957,10 +1350,35 @@ cJSON *cJSON_GetArrayItem(cJSON *array, int item) {
   while (c && item > 0) item--, c = c->next;
   return c;
 }
+/* Keys this thread resolved lately, by address. A hit is checked against the interned copy since
+ * the memory of a key may have been reused for another one */
+#define KEY_CACHE_SIZE 16
+static __thread struct {
+  const char *key;
+  const char *interned;
+} keyCache[KEY_CACHE_SIZE];
+
+const char *cJSON_KeyHandle(const char *key) {
+  unsigned slot = ((uintptr_t)key >> 3) % KEY_CACHE_SIZE;
+  if (keyCache[slot].key == key && strcmp(keyCache[slot].interned, key) == 0) {
+    return keyCache[slot].interned;
+  }
+  // parsed keys are all interned, one that isn't can't be found in any object
+  const char *interned = sm_nget(sm, key, strlen(key));
+  if (interned) {
+    keyCache[slot].key = key;
+    keyCache[slot].interned = interned;
+  }
+  return interned;
+}
+
 cJSON *cJSON_GetObjectItem(cJSON *object, const char *string) {
+  return cJSON_GetObjectItemInterned(object, cJSON_KeyHandle(string));
+}
+cJSON *cJSON_GetObjectItemInterned(cJSON *object, const char *key) {
   cJSON *c = object->child;
-  char *k = sm_put(sm, string);
-  while (c && c->string != k) c = c->next;
+  if (key == NULL) return NULL;
+  while (c && c->string != key) c = c->next;
   return c;
 }
 cJSON *cJSON_GetObjectItemCase(cJSON *object, const char *string) {
@@ -88,6 +88,12 @@ extern cJSON *cJSON_GetArrayItem(cJSON *array, int item);
 /* Get item "string" from object. Case insensitive. */
 extern cJSON *cJSON_GetObjectItem(cJSON *object, const char *string);
 extern cJSON *cJSON_GetObjectItemCase(cJSON *object, const char *string);
+/* Resolve a key to the handle object keys are interned as, NULL when no parsed object has that
+ * key. Nothing is interned. cJSON_GetObjectItem does it on every call, through a small per thread
+ * cache */
+extern const char *cJSON_KeyHandle(const char *key);
+/* Get item of the key handle from cJSON_KeyHandle, comparing handles only */
+extern cJSON *cJSON_GetObjectItemInterned(cJSON *object, const char *key);
 
 /* For analysing failed parses. This returns a pointer to the parse error. You'll probably need to
  * look a few chars back to make sense of it. Defined when cJSON_Parse() returns 0. 0 when
@@ -147,6 +153,65 @@ extern cJSON *cJSON_ParseWithOpts(const char *value, const char **return_parse_e
 
 extern void cJSON_Minify(char *json);
 
+/* Scan the JSON text in value once and fill items[i] with the top level value of keys[i], as
+ * cJSON_GetObjectItem would find it in the parsed object, without building a tree or interning
+ * keys. keys must be distinct. Only strings are extracted, items whose key is missing or holds
+ * another type are left with type cJSON_NULL; item->string is set when the key was found. Strings
+ * reference value like parsed ones do, unless they had escapes. Returns a pointer past the parsed
+ * value, or 0 if it isn't valid JSON. */
+extern const char *cJSON_Extract(const char *value, const char **keys, const size_t *keyLens,
+                                 int n, cJSON *items);
+/* Free the unescaped strings of extracted items. */
+extern void cJSON_FreeExtracted(cJSON *items, int n);
+
+/* Flat form of the top level members of a JSON object, in a single allocation. Values aren't
+ * parsed into items but referenced in the parsed text, looking a key up reads a few contiguous
+ * entries instead of chasing item pointers. */
+#define cJSON_TapeUnescaped 1024 /* the string is in the unescaped copies of the tape */
+
+typedef struct cJSON_TapeEntry {
+  const char *key; /* interned like the keys of parsed objects, compare by address */
+  unsigned offset; /* of the value in doc, or in unescaped, past the quote for strings */
+  unsigned len;    /* of the string, or of the value text for other types */
+  int type;
+} cJSON_TapeEntry;
+
+typedef struct cJSON_Tape {
+  const char *doc; /* the parsed text, which must outlive the tape */
+  char *unescaped; /* NULL terminated copies of the strings that had escapes */
+  unsigned unescapedLen;
+  int size;
+  cJSON_TapeEntry entries[];
+} cJSON_Tape;
+
+/* Parse value into a tape, the members of an object as cJSON_GetObjectItem would find them.
+ * Valid JSON that isn't an object gives an empty tape. Returns 0 if value isn't valid JSON. */
+extern cJSON_Tape *cJSON_ParseTape(const char *value);
+/* cJSON_ParseTape for a value of len bytes, parsed in two stages: json_structurals finds where its
+ * strings and structural characters are with SIMD, then the tape is built from their positions
+ * without going through the text byte by byte. Gives the same tape as cJSON_ParseTape, which
+ * takes over on anything unusual. */
+extern cJSON_Tape *cJSON_ParseTapeLen(const char *value, size_t len);
+extern void cJSON_DeleteTape(cJSON_Tape *tape);
+extern size_t cJSON_TapeMemUsage(const cJSON_Tape *tape);
+
+/* Get the entry of the key handle from cJSON_KeyHandle, the first one if it repeats. */
+static inline const cJSON_TapeEntry *cJSON_TapeGet(const cJSON_Tape *tape, const char *key) {
+  for (int i = 0; i < tape->size; i++) {
+    if (tape->entries[i].key == key) return &tape->entries[i];
+  }
+  return 0;
+}
+
+/* Get the string value of the key handle, 0 when it is missing or holds another type. */
+static inline const char *cJSON_TapeGetString(const cJSON_Tape *tape, const char *key,
+                                              size_t *len) {
+  const cJSON_TapeEntry *entry = cJSON_TapeGet(tape, key);
+  if (!entry || (entry->type & 0xFF) != cJSON_String) return 0;
+  *len = entry->len;
+  return (entry->type & cJSON_TapeUnescaped ? tape->unescaped : tape->doc) + entry->offset;
+}
+
 /* Macros for creating things quickly. */
 #define cJSON_AddNullToObject(object, name) cJSON_AddItemToObject(object, name, cJSON_CreateNull())
 #define cJSON_AddTrueToObject(object, name) cJSON_AddItemToObject(object, name, cJSON_CreateTrue())
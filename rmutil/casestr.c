@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include "casestr.h"
+#include "cpu.h"
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+/* Haystacks shorter than this are searched by the scalar loop, which returns before the SIMD
+ * kernels have set their registers up. From CASESTR_AVX2_MIN bytes AVX2 pays for entering it,
+ * below it is slower than SSE2, see bench_casestr */
+#define CASESTR_SIMD_MIN 8
+#define CASESTR_AVX2_MIN 256
+
+static inline unsigned char fold(unsigned char c) {
+  return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+/* Bit to set on a haystack byte before comparing it with the folded needle byte c. Only the
+ * two cases of a letter agree with it once the bit is set, any other byte must be equal */
+static inline unsigned char foldMask(unsigned char c) {
+  return c >= 'a' && c <= 'z' ? 0x20 : 0;
+}
+
+static inline int caseEqual(const char *a, const char *b, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    if (fold(a[i]) != fold(b[i])) return 0;
+  }
+  return 1;
+}
+
+/* Scalar search of the matches starting at or after from */
+static const char *findFrom(const char *hay, size_t n, const char *needle, size_t m, size_t from) {
+  unsigned char first = fold(needle[0]);
+  for (size_t i = from; i + m <= n; i++) {
+    if (fold(hay[i]) == first && caseEqual(hay + i + 1, needle + 1, m - 1)) return hay + i;
+  }
+  return NULL;
+}
+
+const char *casestr_find_scalar(const char *hay, size_t n, const char *needle, size_t m) {
+  if (m == 0) return hay;
+  return findFrom(hay, n, needle, m, 0);
+}
+
+#ifdef __SSE2__
+
+#define PAGE_SIZE 4096
+
+/* Tell if a 16 byte load at p stays in its page, so reading past the end of a string can't fault */
+static inline int samePage16(const char *p) {
+  return ((uintptr_t)p & (PAGE_SIZE - 1)) <= PAGE_SIZE - 16;
+}
+
+/*
+* The last block of fewer than 16 starts is loaded whole when it doesn't
+* cross a page, and the starts past the end are masked off. Names and
+* departments are shorter than a block, this is where they are searched.
+*/
+__attribute__((no_sanitize_address)) const char *casestr_find_sse2(const char *hay, size_t n,
+                                                                   const char *needle, size_t m) {
+  if (m == 0) return hay;
+  if (n < m) return NULL;
+
+  unsigned char first = fold(needle[0]), last = fold(needle[m - 1]);
+  const __m128i vfirst = _mm_set1_epi8(first), vlast = _mm_set1_epi8(last);
+  const __m128i mfirst = _mm_set1_epi8(foldMask(first)), mlast = _mm_set1_epi8(foldMask(last));
+  size_t inner = m > 2 ? m - 2 : 0;
+  size_t starts = n - m + 1;
+  size_t i = 0;
+
+  while (i < starts) {
+    uint32_t valid = 0xFFFF;
+    if (starts - i < 16) {
+      if (!samePage16(hay + i) || !samePage16(hay + i + m - 1)) break;
+      valid = (1u << (starts - i)) - 1;
+    }
+    __m128i head = _mm_loadu_si128((const __m128i *)(hay + i));
+    __m128i tail = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+    __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(_mm_or_si128(head, mfirst), vfirst),
+                               _mm_cmpeq_epi8(_mm_or_si128(tail, mlast), vlast));
+    uint32_t mask = _mm_movemask_epi8(eq) & valid;
+    while (mask) {
+      size_t pos = i + __builtin_ctz(mask);
+      if (caseEqual(hay + pos + 1, needle + 1, inner)) return hay + pos;
+      mask &= mask - 1;
+    }
+    i += 16;
+  }
+  return findFrom(hay, n, needle, m, i);
+}
+
+__attribute__((target("avx2"))) static const char *findAvx2(const char *hay, size_t n,
+                                                            const char *needle, size_t m) {
+  if (m == 0 || n < m + 31) return casestr_find_sse2(hay, n, needle, m);
+
+  unsigned char first = fold(needle[0]), last = fold(needle[m - 1]);
+  const __m256i vfirst = _mm256_set1_epi8(first), vlast = _mm256_set1_epi8(last);
+  const __m256i mfirst = _mm256_set1_epi8(foldMask(first));
+  const __m256i mlast = _mm256_set1_epi8(foldMask(last));
+  size_t inner = m > 2 ? m - 2 : 0;
+  size_t i = 0;
+
+  for (; i + 32 <= n - m + 1; i += 32) {
+    __m256i head = _mm256_loadu_si256((const __m256i *)(hay + i));
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(hay + i + m - 1));
+    __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_or_si256(head, mfirst), vfirst),
+                                  _mm256_cmpeq_epi8(_mm256_or_si256(tail, mlast), vlast));
+    uint32_t mask = _mm256_movemask_epi8(eq);
+    while (mask) {
+      size_t pos = i + __builtin_ctz(mask);
+      if (caseEqual(hay + pos + 1, needle + 1, inner)) return hay + pos;
+      mask &= mask - 1;
+    }
+  }
+  // the SSE2 kernel takes the last starts, fewer than 32. Running SSE code with dirty ymm
+  // registers costs hundreds of cycles on some CPUs
+  _mm256_zeroupper();
+  return casestr_find_sse2(hay + i, n - i, needle, m);
+}
+
+#else
+
+const char *casestr_find_sse2(const char *hay, size_t n, const char *needle, size_t m) {
+  return casestr_find_scalar(hay, n, needle, m);
+}
+
+#endif
+
+const char *casestr_find(const char *hay, size_t n, const char *needle, size_t m) {
+  if (n < CASESTR_SIMD_MIN) return casestr_find_scalar(hay, n, needle, m);
+#ifdef __SSE2__
+  if (n >= CASESTR_AVX2_MIN && cpu_has_avx2()) return findAvx2(hay, n, needle, m);
+#endif
+  return casestr_find_sse2(hay, n, needle, m);
+}
+
+const char *casestr_impl() {
+#ifdef __SSE2__
+  return cpu_has_avx2() ? "avx2" : "sse2";
+#else
+  return "scalar";
+#endif
+}
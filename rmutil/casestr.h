@@ -0,0 +1,27 @@
+#ifndef __CASESTR_H__
+#define __CASESTR_H__
+
+#include <stddef.h>
+
+/*
+* ASCII case insensitive substring search over length delimited strings,
+* neither string has to be NULL terminated. Returns a pointer to the first
+* occurrence of needle in hay, hay itself for an empty needle, or NULL.
+*
+* The search looks for the first and last byte of the needle at 16 (SSE2) or
+* 32 (AVX2) positions of hay at once and only compares the rest of the needle
+* where both match. Only long haystacks like column heaps are searched with
+* AVX2, when cpuid reports it, and very short ones with the scalar loop. CPUs
+* without SSE2 always take the scalar loop.
+*/
+const char *casestr_find(const char *hay, size_t n, const char *needle, size_t m);
+
+/* The scalar and SSE2 kernels, exposed for tests and benchmarks. casestr_find_sse2 is the
+ * scalar kernel on CPUs without SSE2 */
+const char *casestr_find_scalar(const char *hay, size_t n, const char *needle, size_t m);
+const char *casestr_find_sse2(const char *hay, size_t n, const char *needle, size_t m);
+
+/* Name of the kernel casestr_find dispatches long haystacks to on this CPU */
+const char *casestr_impl();
+
+#endif
@@ -0,0 +1,296 @@
+#include <string.h>
+#include "column.h"
+#include "casestr.h"
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+/* Heaps smaller than this are never compacted */
+#define COLUMN_MIN_COMPACT 4096
+
+Column *NewColumn() {
+  Column *c = calloc(1, sizeof(Column));
+  c->dict = calloc(COLUMN_MAX_CODES, sizeof(ColumnCode));
+  c->codeOf = NewDict(16);
+  return c;
+}
+
+static void freeDict(Column *c) {
+  for (int code = 0; code < c->numCodes; code++) {
+    free(c->dict[code].value);
+  }
+  free(c->dict);
+  Dict_Free(c->codeOf, NULL);
+  free(c->codes);
+  c->dict = NULL;
+  c->codeOf = NULL;
+  c->codes = NULL;
+}
+
+void Column_Free(Column *c) {
+  if (c->dict) freeDict(c);
+  free(c->heap);
+  free(c->offsets);
+  free(c->lens);
+  free(c->values);
+  free(c);
+}
+
+static void growRows(Column *c, uint32_t row) {
+  uint32_t n = c->numRows ? c->numRows : 16;
+  while (n <= row) n *= 2;
+  if (c->dict) {
+    c->codes = realloc(c->codes, n);
+    memset(c->codes + c->numRows, COLUMN_NULL_CODE, n - c->numRows);
+  } else {
+    c->offsets = realloc(c->offsets, n * sizeof(size_t));
+    c->lens = realloc(c->lens, n * sizeof(uint32_t));
+    for (uint32_t i = c->numRows; i < n; i++) {
+      c->lens[i] = COLUMN_NULL;
+    }
+  }
+  c->numRows = n;
+}
+
+static void appendValue(Column *c, uint32_t row, const char *value, size_t len) {
+  if (c->heapLen + len + 1 > c->heapCap) {
+    c->heapCap = (c->heapLen + len + 1) * 2;
+    c->heap = realloc(c->heap, c->heapCap);
+  }
+  if (c->numValues == c->valuesCap) {
+    c->valuesCap = c->valuesCap ? c->valuesCap * 2 : 16;
+    c->values = realloc(c->values, c->valuesCap * sizeof(ColumnValue));
+  }
+  c->values[c->numValues++] = (ColumnValue){.row = row, .len = len};
+  c->offsets[row] = c->heapLen;
+  c->lens[row] = len;
+  memcpy(c->heap + c->heapLen, value, len);
+  c->heap[c->heapLen + len] = '\0';
+  c->heapLen += len + 1;
+}
+
+/* Rewrite the live values in row order, dropping the dead ones */
+static void compact(Column *c) {
+  char *old = c->heap;
+  c->heap = malloc(c->heapLen - c->garbage);
+  c->heapCap = c->heapLen - c->garbage;
+  c->heapLen = c->garbage = 0;
+  c->numValues = 0;
+  for (uint32_t row = 0; row < c->numRows; row++) {
+    if (c->lens[row] != COLUMN_NULL) appendValue(c, row, old + c->offsets[row], c->lens[row]);
+  }
+  free(old);
+}
+
+static void release(Column *c, uint32_t row) {
+  if (row >= c->numRows || c->lens[row] == COLUMN_NULL) return;
+  c->garbage += c->lens[row] + 1;
+  c->lens[row] = COLUMN_NULL;
+}
+
+static void releaseCode(Column *c, uint32_t row) {
+  if (row >= c->numRows || c->codes[row] == COLUMN_NULL_CODE) return;
+  ColumnCode *code = &c->dict[c->codes[row]];
+  c->codes[row] = COLUMN_NULL_CODE;
+  if (--code->refs > 0) return;
+
+  // the code goes back to the free ones
+  Dict_Delete(c->codeOf, code->value, code->len);
+  free(code->value);
+  code->value = NULL;
+}
+
+/* Return the code of value, adding it to the dictionary if new. Returns
+ * COLUMN_NULL_CODE when the dictionary is full */
+static int codeOf(Column *c, const char *value, size_t len) {
+  void *found = Dict_Get(c->codeOf, value, len);
+  if (found) return (int)((uintptr_t)found - 1);
+
+  int code = 0;
+  while (code < c->numCodes && c->dict[code].value) code++;
+  if (code == COLUMN_MAX_CODES) return COLUMN_NULL_CODE;
+  if (code == c->numCodes) c->numCodes++;
+
+  c->dict[code].value = malloc(len + 1);
+  memcpy(c->dict[code].value, value, len);
+  c->dict[code].value[len] = '\0';
+  c->dict[code].len = len;
+  Dict_Set(c->codeOf, value, len, (void *)(uintptr_t)(code + 1));
+  return code;
+}
+
+/* Move the values of the rows to the heap, once there are too many distinct ones to encode */
+static void decode(Column *c) {
+  uint8_t *codes = c->codes;
+  ColumnCode *dict = c->dict;
+  uint32_t numRows = c->numRows;
+  c->codes = NULL;
+  c->dict = NULL;
+  c->numRows = 0;
+  if (numRows) growRows(c, numRows - 1);
+  for (uint32_t row = 0; row < numRows; row++) {
+    if (codes[row] != COLUMN_NULL_CODE) {
+      appendValue(c, row, dict[codes[row]].value, dict[codes[row]].len);
+    }
+  }
+  c->codes = codes;
+  c->dict = dict;
+  freeDict(c);
+}
+
+void Column_Set(Column *c, uint32_t row, const char *value, size_t len) {
+  if (row >= c->numRows) growRows(c, row);
+  if (c->dict) {
+    releaseCode(c, row);
+    int code = codeOf(c, value, len);
+    if (code != COLUMN_NULL_CODE) {
+      c->codes[row] = code;
+      c->dict[code].refs++;
+      return;
+    }
+    decode(c);
+  }
+  release(c, row);
+  appendValue(c, row, value, len);
+  if (c->heapLen >= COLUMN_MIN_COMPACT && c->garbage * 2 > c->heapLen) compact(c);
+}
+
+void Column_Delete(Column *c, uint32_t row) {
+  if (c->dict) {
+    releaseCode(c, row);
+    return;
+  }
+  release(c, row);
+  if (c->heapLen >= COLUMN_MIN_COMPACT && c->garbage * 2 > c->heapLen) compact(c);
+}
+
+const char *Column_Get(const Column *c, uint32_t row, size_t *len) {
+  if (c->dict) {
+    if (row >= c->numRows || c->codes[row] == COLUMN_NULL_CODE) return NULL;
+    *len = c->dict[c->codes[row]].len;
+    return c->dict[c->codes[row]].value;
+  }
+  if (row >= c->numRows || c->lens[row] == COLUMN_NULL) return NULL;
+  *len = c->lens[row];
+  return c->heap + c->offsets[row];
+}
+
+int Column_IsEncoded(const Column *c) {
+  return c->dict != NULL;
+}
+
+/* Add the rows holding code, 16 codes are compared at a time */
+static void findCode(const Column *c, uint8_t code, Bitmap *out) {
+  uint32_t row = 0;
+#ifdef __SSE2__
+  const __m128i want = _mm_set1_epi8((char)code);
+  for (; row + 16 <= c->numRows; row += 16) {
+    __m128i codes = _mm_loadu_si128((const __m128i *)(c->codes + row));
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(codes, want));
+    while (mask) {
+      Bitmap_Add(out, row + __builtin_ctz(mask));
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; row < c->numRows; row++) {
+    if (c->codes[row] == code) Bitmap_Add(out, row);
+  }
+}
+
+/* Substring search of a dictionary encoded column, the distinct values are searched once */
+static void findCaseEncoded(const Column *c, const char *needle, size_t len, Bitmap *out) {
+  uint8_t matches[256] = {0};
+  int numMatches = 0, last = 0;
+  for (int code = 0; code < c->numCodes; code++) {
+    const ColumnCode *v = &c->dict[code];
+    if (v->value && casestr_find(v->value, v->len, needle, len)) {
+      matches[code] = 1;
+      numMatches++;
+      last = code;
+    }
+  }
+
+  if (numMatches == 1) {
+    findCode(c, last, out);
+  } else if (numMatches > 1) {
+    for (uint32_t row = 0; row < c->numRows; row++) {
+      if (matches[c->codes[row]]) Bitmap_Add(out, row);
+    }
+  }
+}
+
+/* A value whose row was set again since lives on further in the heap */
+static inline int isLive(const Column *c, const ColumnValue *v, size_t offset) {
+  return c->lens[v->row] != COLUMN_NULL && c->offsets[v->row] == offset;
+}
+
+void Column_FindCase(const Column *c, const char *needle, size_t len, Bitmap *out) {
+  if (c->dict) {
+    findCaseEncoded(c, needle, len, out);
+    return;
+  }
+
+  size_t offset = 0;
+  uint32_t i = 0;
+  while (i < c->numValues) {
+    const char *match = len ? casestr_find(c->heap + offset, c->heapLen - offset, needle, len)
+                            : c->heap + offset;
+    if (match == NULL) break;
+
+    // skip to the value holding the match, then search on from the next one
+    size_t at = match - c->heap;
+    while (offset + c->values[i].len < at) {
+      offset += c->values[i].len + 1;
+      i++;
+    }
+    if (isLive(c, &c->values[i], offset)) Bitmap_Add(out, c->values[i].row);
+    offset += c->values[i].len + 1;
+    i++;
+  }
+}
+
+static inline void addIfEqual(const Column *c, uint32_t row, const char *value, size_t len,
+                              Bitmap *out) {
+  if (memcmp(c->heap + c->offsets[row], value, len) == 0) Bitmap_Add(out, row);
+}
+
+void Column_Equals(const Column *c, const char *value, size_t len, Bitmap *out) {
+  if (c->dict) {
+    void *code = Dict_Get(c->codeOf, value, len);
+    if (code) findCode(c, (uintptr_t)code - 1, out);
+    return;
+  }
+  if (len >= COLUMN_NULL) return;
+
+  uint32_t row = 0;
+#ifdef __SSE2__
+  // only the rows of the right length are compared, the lengths are checked 4 at a time
+  const __m128i want = _mm_set1_epi32((int)len);
+  for (; row + 4 <= c->numRows; row += 4) {
+    __m128i lens = _mm_loadu_si128((const __m128i *)(c->lens + row));
+    uint32_t mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lens, want)));
+    while (mask) {
+      addIfEqual(c, row + __builtin_ctz(mask), value, len, out);
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; row < c->numRows; row++) {
+    if (c->lens[row] == len) addIfEqual(c, row, value, len, out);
+  }
+}
+
+size_t Column_MemUsage(const Column *c) {
+  if (c->dict) {
+    size_t mem = sizeof(Column) + c->numRows + COLUMN_MAX_CODES * sizeof(ColumnCode) +
+                 Dict_MemUsage(c->codeOf);
+    for (int code = 0; code < c->numCodes; code++) {
+      if (c->dict[code].value) mem += c->dict[code].len + 1;
+    }
+    return mem;
+  }
+  return sizeof(Column) + c->heapCap + c->numRows * (sizeof(size_t) + sizeof(uint32_t)) +
+         c->valuesCap * sizeof(ColumnValue);
+}
@@ -0,0 +1,92 @@
+#ifndef __COLUMN_H__
+#define __COLUMN_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "bitmap.h"
+#include "dict.h"
+
+/* Length of a row that has no value */
+#define COLUMN_NULL UINT32_MAX
+
+/* Distinct values a column keeps dictionary encoded, and the code of rows without value */
+#define COLUMN_MAX_CODES 255
+#define COLUMN_NULL_CODE 255
+
+/* A distinct value of a dictionary encoded column */
+typedef struct {
+  char *value;    // NULL for a free code
+  uint32_t len;
+  uint32_t refs;  // rows holding the value
+} ColumnCode;
+
+/* A value in the heap, in the order the heap holds them */
+typedef struct {
+  uint32_t row;
+  uint32_t len;
+} ColumnValue;
+
+/*
+* String values of one field for a set of rows, kept column-wise: the bytes of
+* every value back to back in one heap, and the offset and length of the value
+* of each row in arrays indexed by row. Predicates are evaluated for the whole
+* column at once into a Bitmap of rows. A substring search runs over the heap
+* in a single pass instead of one call per value, as values are NUL separated
+* a match never straddles two of them.
+*
+* Setting a row appends its value to the heap, the bytes of replaced and
+* removed values are reclaimed by compacting the heap once they are the
+* larger part of it.
+*
+* Columns start dictionary encoded instead, which suits low cardinality
+* fields like a department: each distinct value is stored once and rows hold
+* its one byte code. An equality predicate looks the code of its value up
+* once and compares 16 row codes at a time, a substring search only looks at
+* the distinct values. Past COLUMN_MAX_CODES distinct values at once the
+* column switches to the heap for good. Not thread safe.
+*/
+typedef struct {
+  uint8_t *codes;        // by row, while dictionary encoded
+  ColumnCode *dict;      // by code, NULL once the column uses the heap
+  Dict *codeOf;          // value -> code + 1
+  int numCodes;          // codes handed out, free ones included
+  char *heap;
+  size_t heapLen;
+  size_t heapCap;
+  size_t garbage;        // heap bytes no row points at anymore
+  size_t *offsets;       // by row, into heap
+  uint32_t *lens;        // by row, COLUMN_NULL for rows without value
+  uint32_t numRows;      // size of codes, or of offsets and lens
+  ColumnValue *values;   // dead ones included until the heap is compacted
+  uint32_t numValues;
+  uint32_t valuesCap;
+} Column;
+
+Column *NewColumn();
+
+void Column_Free(Column *c);
+
+/* Set the value of row, replacing its previous one */
+void Column_Set(Column *c, uint32_t row, const char *value, size_t len);
+
+/* Remove the value of row, if any */
+void Column_Delete(Column *c, uint32_t row);
+
+/* Return the value of row, NULL if it has none. It stays valid until the
+ * column is modified */
+const char *Column_Get(const Column *c, uint32_t row, size_t *len);
+
+/* Add to out the rows whose value contains needle, ignoring ASCII case. An
+ * empty needle matches every row with a value */
+void Column_FindCase(const Column *c, const char *needle, size_t len, Bitmap *out);
+
+/* Add to out the rows whose value is exactly value */
+void Column_Equals(const Column *c, const char *value, size_t len, Bitmap *out);
+
+/* Tell if the column is still dictionary encoded */
+int Column_IsEncoded(const Column *c);
+
+/* Approximate number of bytes used by the column */
+size_t Column_MemUsage(const Column *c);
+
+#endif
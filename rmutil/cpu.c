@@ -0,0 +1,41 @@
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+/* Leaf 1 ecx and leaf 7 ebx bits */
+#define CPUID_OSXSAVE (1 << 27)
+#define CPUID_AVX (1 << 28)
+#define CPUID_AVX2 (1 << 5)
+
+/* xmm and ymm state, in XCR0 */
+#define XCR0_AVX_STATE 0x6
+
+static int detectAvx2() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+  if (!(ecx & CPUID_OSXSAVE) || !(ecx & CPUID_AVX)) return 0;
+
+  unsigned int xcr0, xcr0High;
+  __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(xcr0High) : "c"(0));
+  if ((xcr0 & XCR0_AVX_STATE) != XCR0_AVX_STATE) return 0;
+
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+  return (ebx & CPUID_AVX2) != 0;
+}
+
+#else
+
+static int detectAvx2() {
+  return 0;
+}
+
+#endif
+
+// detected on first use, threads racing there store the same value
+static int hasAvx2 = -1;
+
+int cpu_has_avx2() {
+  if (hasAvx2 < 0) hasAvx2 = detectAvx2();
+  return hasAvx2;
+}
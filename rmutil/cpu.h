@@ -0,0 +1,13 @@
+#ifndef __CPU_H__
+#define __CPU_H__
+
+/*
+* Features of the CPU the process runs on, read with cpuid so no libgcc
+* runtime is needed: __builtin_cpu_supports leaves __cpu_model undefined in a
+* module linked without libgcc, which then fails to load.
+*/
+
+/* Tell if AVX2 can be used, which also takes the OS saving the ymm registers */
+int cpu_has_avx2();
+
+#endif
@@ -0,0 +1,148 @@
+#include "dict.h"
+
+static unsigned int dict_hash(const char *key, size_t len) {
+  // FNV-1a, good enough for field names and short tokens
+  unsigned int h = 2166136261u;
+  while (len--) {
+    h ^= (unsigned char)*key++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void dict_grow(Dict *d) {
+  size_t cap = d->cap * 2;
+  DictEntry **table = calloc(cap, sizeof(DictEntry *));
+  if (!table) return;
+
+  for (size_t i = 0; i < d->cap; i++) {
+    DictEntry *e = d->table[i];
+    while (e) {
+      DictEntry *next = e->next;
+      size_t idx = e->hash & (cap - 1);
+      e->next = table[idx];
+      table[idx] = e;
+      e = next;
+    }
+  }
+  free(d->table);
+  d->table = table;
+  d->cap = cap;
+}
+
+Dict *NewDict(size_t cap) {
+  size_t n = 4;
+  while (n < cap) n <<= 1;
+
+  Dict *d = malloc(sizeof(Dict));
+  if (!d) return NULL;
+  d->table = calloc(n, sizeof(DictEntry *));
+  if (!d->table) {
+    free(d);
+    return NULL;
+  }
+  d->cap = n;
+  d->size = 0;
+  return d;
+}
+
+static DictEntry **dict_find(Dict *d, const char *key, size_t len, unsigned int hash) {
+  DictEntry **ep = &d->table[hash & (d->cap - 1)];
+  while (*ep) {
+    DictEntry *e = *ep;
+    if (e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0) {
+      return ep;
+    }
+    ep = &e->next;
+  }
+  return ep;
+}
+
+void *Dict_Get(Dict *d, const char *key, size_t len) {
+  DictEntry *e = *dict_find(d, key, len, dict_hash(key, len));
+  return e ? e->val : NULL;
+}
+
+int Dict_Set(Dict *d, const char *key, size_t len, void *val) {
+  unsigned int hash = dict_hash(key, len);
+  DictEntry **ep = dict_find(d, key, len, hash);
+  if (*ep) {
+    (*ep)->val = val;
+    return 0;
+  }
+
+  DictEntry *e = malloc(sizeof(DictEntry) + len + 1);
+  if (!e) return -1;
+  e->hash = hash;
+  e->len = len;
+  e->val = val;
+  memcpy(e->key, key, len);
+  e->key[len] = '\0';
+  e->next = NULL;
+  *ep = e;
+
+  if (++d->size > d->cap) {
+    dict_grow(d);
+  }
+  return 1;
+}
+
+void *Dict_Delete(Dict *d, const char *key, size_t len) {
+  DictEntry **ep = dict_find(d, key, len, dict_hash(key, len));
+  DictEntry *e = *ep;
+  if (!e) return NULL;
+
+  void *val = e->val;
+  *ep = e->next;
+  free(e);
+  d->size--;
+  return val;
+}
+
+inline size_t Dict_Size(Dict *d) {
+  return d->size;
+}
+
+size_t Dict_MemUsage(Dict *d) {
+  size_t mem = sizeof(Dict) + d->cap * sizeof(DictEntry *);
+  for (size_t i = 0; i < d->cap; i++) {
+    for (DictEntry *e = d->table[i]; e; e = e->next) {
+      mem += sizeof(DictEntry) + e->len + 1;
+    }
+  }
+  return mem;
+}
+
+void Dict_Free(Dict *d, void (*freeVal)(void *)) {
+  for (size_t i = 0; i < d->cap; i++) {
+    DictEntry *e = d->table[i];
+    while (e) {
+      DictEntry *next = e->next;
+      if (freeVal) freeVal(e->val);
+      free(e);
+      e = next;
+    }
+  }
+  free(d->table);
+  free(d);
+}
+
+DictIterator Dict_Iterate(Dict *d) {
+  DictIterator it = {.d = d, .bucket = 0, .entry = NULL};
+  return it;
+}
+
+DictEntry *DictIterator_Next(DictIterator *it) {
+  if (it->entry) {
+    it->entry = it->entry->next;
+    if (it->entry) return it->entry;
+    it->bucket++;
+  }
+  while (it->bucket < it->d->cap) {
+    if ((it->entry = it->d->table[it->bucket])) {
+      return it->entry;
+    }
+    it->bucket++;
+  }
+  return NULL;
+}
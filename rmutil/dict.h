@@ -0,0 +1,64 @@
+#ifndef __DICT_H__
+#define __DICT_H__
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+* A simple chained hash table mapping binary safe keys to opaque pointers.
+* Keys are copied into the table, values are stored as-is and are never
+* released by the dict itself unless a free function is passed to Dict_Free.
+*/
+typedef struct dictEntry {
+  struct dictEntry *next;
+  void *val;
+  unsigned int hash;
+  size_t len;
+  char key[];
+} DictEntry;
+
+typedef struct {
+  DictEntry **table;
+  size_t cap;
+  size_t size;
+} Dict;
+
+typedef struct {
+  Dict *d;
+  size_t bucket;
+  DictEntry *entry;
+} DictIterator;
+
+/* Create a new dict with an initial number of buckets (rounded up to a power of two) */
+Dict *NewDict(size_t cap);
+
+/* Return the value stored under key, or NULL if the key is not in the dict */
+void *Dict_Get(Dict *d, const char *key, size_t len);
+
+/* Set the value of key, replacing any previous value. Returns 1 if the key was
+ * added, 0 if an existing key was updated */
+int Dict_Set(Dict *d, const char *key, size_t len, void *val);
+
+/* Remove key from the dict, returning its value or NULL if it was not found */
+void *Dict_Delete(Dict *d, const char *key, size_t len);
+
+/* return the number of keys in the dict */
+size_t Dict_Size(Dict *d);
+
+/* Approximate number of bytes used by the dict, not including the values */
+size_t Dict_MemUsage(Dict *d);
+
+/* free the dict and its keys. If freeVal is not NULL it is called on every value */
+void Dict_Free(Dict *d, void (*freeVal)(void *));
+
+/* Iterate over all entries. The dict must not be modified while iterating.
+ * e.g.
+ *  DictIterator it = Dict_Iterate(d);
+ *  DictEntry *e;
+ *  while ((e = DictIterator_Next(&it))) { ... }
+ */
+DictIterator Dict_Iterate(Dict *d);
+
+DictEntry *DictIterator_Next(DictIterator *it);
+
+#endif
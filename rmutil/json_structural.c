@@ -0,0 +1,223 @@
+#include <string.h>
+#include "json_structural.h"
+#include "cpu.h"
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+size_t json_structurals_scalar(const char *text, size_t len, uint32_t *out) {
+  size_t n = 0;
+  int inString = 0;
+  for (size_t i = 0; i < len; i++) {
+    char c = text[i];
+    if (c == '\0') return JSON_STRUCTURAL_NUL;
+    // a backslash escapes the next character, out of strings too where it is invalid anyway
+    if (c == '\\') {
+      if (i + 1 < len && text[i + 1] == '\0') return JSON_STRUCTURAL_NUL;
+      out[n++] = i++;
+    } else if (c == '"') {
+      inString = !inString;
+      out[n++] = i;
+    } else if (!inString && strchr("{}[]:,", c)) {
+      out[n++] = i;
+    }
+  }
+  return n;
+}
+
+#ifdef __SSE2__
+
+/* Masks of a block of 64 bytes, bit i for byte i */
+typedef struct {
+  uint64_t quote;
+  uint64_t backslash;
+  uint64_t structural;
+  uint64_t nul;
+} blockMasks;
+
+/* State carried from a block to the next */
+typedef struct {
+  uint64_t escaped;   // bit 0 set when the previous block ended with an escaping backslash
+  uint64_t inString;  // all ones when the previous block ended inside a string
+} scanState;
+
+static inline uint64_t mask16(__m128i v, __m128i c) {
+  return (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, c));
+}
+
+static inline void classify16(const char *p, blockMasks *m) {
+  const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+  const __m128i caseBit = _mm_set1_epi8(0x20), zero = _mm_setzero_si128();
+  // '[' and ']' are '{' and '}' without the 0x20 bit
+  const __m128i open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}');
+  const __m128i colon = _mm_set1_epi8(':'), comma = _mm_set1_epi8(',');
+  m->quote = m->backslash = m->structural = m->nul = 0;
+  for (int i = 0; i < 4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i * 16));
+    __m128i folded = _mm_or_si128(v, caseBit);
+    __m128i s = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+    m->quote |= mask16(v, quote) << (i * 16);
+    m->backslash |= mask16(v, backslash) << (i * 16);
+    m->structural |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << (i * 16);
+    m->nul |= mask16(v, zero) << (i * 16);
+  }
+}
+
+__attribute__((target("avx2"))) static inline uint64_t mask32(__m256i v, __m256i c) {
+  return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, c));
+}
+
+__attribute__((target("avx2"))) static inline void classify32(const char *p, blockMasks *m) {
+  const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+  const __m256i caseBit = _mm256_set1_epi8(0x20), zero = _mm256_setzero_si256();
+  const __m256i open = _mm256_set1_epi8('{'), close = _mm256_set1_epi8('}');
+  const __m256i colon = _mm256_set1_epi8(':'), comma = _mm256_set1_epi8(',');
+  m->quote = m->backslash = m->structural = m->nul = 0;
+  for (int i = 0; i < 2; i++) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i * 32));
+    __m256i folded = _mm256_or_si256(v, caseBit);
+    __m256i s = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(folded, open), _mm256_cmpeq_epi8(folded, close)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+    m->quote |= mask32(v, quote) << (i * 32);
+    m->backslash |= mask32(v, backslash) << (i * 32);
+    m->structural |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << (i * 32);
+    m->nul |= mask32(v, zero) << (i * 32);
+  }
+}
+
+/* Bits of the characters escaped by a backslash. Backslashes are rare, they are walked one by
+ * one: each one not escaped itself escapes the next character */
+static inline uint64_t escapedChars(uint64_t backslash, scanState *st) {
+  uint64_t escaped = st->escaped;
+  backslash &= ~escaped;
+  st->escaped = 0;
+  while (backslash) {
+    uint64_t bit = backslash & -backslash;
+    if (bit == 1ULL << 63) {
+      st->escaped = 1;
+    } else {
+      escaped |= bit << 1;
+    }
+    backslash &= ~(bit | bit << 1);
+  }
+  return escaped;
+}
+
+/* Bit i is the xor of bits 0 to i: set from an opening quote up to the byte before its closing
+ * one */
+static inline uint64_t prefixXor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/* Turn the masks of the block at base into positions. Returns -1 on a NULL byte */
+static inline int emitBlock(blockMasks *m, scanState *st, uint32_t base, uint32_t *out,
+                            size_t *n) {
+  if (m->nul) return -1;
+  uint64_t escaped = escapedChars(m->backslash, st);
+  uint64_t quotes = m->quote & ~escaped;
+  uint64_t inString = prefixXor(quotes) ^ st->inString;
+  st->inString = (uint64_t)((int64_t)inString >> 63);
+  uint64_t bits = ((m->structural & ~inString) | m->quote | m->backslash) & ~escaped;
+  size_t count = *n;
+  while (bits) {
+    out[count++] = base + __builtin_ctzll(bits);
+    bits &= bits - 1;
+  }
+  *n = count;
+  return 0;
+}
+
+/* The last bytes, fewer than 64, are classified from a copy padded with spaces */
+static inline int emitTail(const char *text, size_t len, size_t i, scanState *st, uint32_t *out,
+                           size_t *n, void (*classify)(const char *, blockMasks *)) {
+  char block[64];
+  blockMasks m;
+  if (i == len) return 0;
+  memset(block, ' ', sizeof(block));
+  memcpy(block, text + i, len - i);
+  classify(block, &m);
+  return emitBlock(&m, st, i, out, n);
+}
+
+size_t json_structurals_sse2(const char *text, size_t len, uint32_t *out) {
+  scanState st = {0, 0};
+  blockMasks m;
+  size_t n = 0, i = 0;
+  for (; i + 64 <= len; i += 64) {
+    classify16(text + i, &m);
+    if (emitBlock(&m, &st, i, out, &n) != 0) return JSON_STRUCTURAL_NUL;
+  }
+  if (emitTail(text, len, i, &st, out, &n, classify16) != 0) return JSON_STRUCTURAL_NUL;
+  return n;
+}
+
+__attribute__((target("avx2"))) static void classifyAvx2(const char *p, blockMasks *m) {
+  classify32(p, m);
+}
+
+__attribute__((target("avx2"))) static size_t structuralsAvx2(const char *text, size_t len,
+                                                              uint32_t *out) {
+  scanState st = {0, 0};
+  blockMasks m;
+  size_t n = 0, i = 0;
+  for (; i + 64 <= len; i += 64) {
+    classify32(text + i, &m);
+    if (emitBlock(&m, &st, i, out, &n) != 0) return JSON_STRUCTURAL_NUL;
+  }
+  if (emitTail(text, len, i, &st, out, &n, classifyAvx2) != 0) return JSON_STRUCTURAL_NUL;
+  return n;
+}
+
+#else
+
+size_t json_structurals_sse2(const char *text, size_t len, uint32_t *out) {
+  return json_structurals_scalar(text, len, out);
+}
+
+#endif
+
+typedef size_t (*structurals_kernel)(const char *, size_t, uint32_t *);
+
+static structurals_kernel selectKernel(const char **name) {
+#ifdef __SSE2__
+  if (cpu_has_avx2()) {
+    *name = "avx2";
+    return structuralsAvx2;
+  }
+  *name = "sse2";
+  return json_structurals_sse2;
+#else
+  *name = "scalar";
+  return json_structurals_scalar;
+#endif
+}
+
+static size_t resolveKernel(const char *text, size_t len, uint32_t *out);
+
+// resolved on first use, threads racing there store the same values
+static structurals_kernel kernel = resolveKernel;
+static const char *kernelName;
+
+static size_t resolveKernel(const char *text, size_t len, uint32_t *out) {
+  kernel = selectKernel(&kernelName);
+  return kernel(text, len, out);
+}
+
+size_t json_structurals(const char *text, size_t len, uint32_t *out) {
+  return kernel(text, len, out);
+}
+
+const char *json_structurals_impl() {
+  if (kernelName == NULL) selectKernel(&kernelName);
+  return kernelName;
+}
@@ -0,0 +1,34 @@
+#ifndef __JSON_STRUCTURAL_H__
+#define __JSON_STRUCTURAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returned for text holding a NULL byte, which C string parsers see as its end */
+#define JSON_STRUCTURAL_NUL ((size_t)-1)
+
+/*
+* First stage of a two stage JSON parser: find the positions of the
+* structural characters of len bytes of text, i.e. the quotes delimiting
+* strings, the backslashes escaping a character and the {}[]:, outside of
+* strings. Escaped characters are never structural. The positions are
+* written in order to out, which needs room for len of them, and their
+* number is returned. Nothing is validated, the second stage checks the
+* text between them.
+*
+* 64 bytes are classified at once into bitmasks of quotes, backslashes and
+* structurals with SSE2 or AVX2, strings are found with a prefix xor of the
+* quotes. AVX2 is used when cpuid reports it, CPUs without SSE2 take the
+* scalar loop.
+*/
+size_t json_structurals(const char *text, size_t len, uint32_t *out);
+
+/* The scalar and SSE2 kernels, exposed for tests. json_structurals_sse2 is the scalar kernel on
+ * CPUs without SSE2 */
+size_t json_structurals_scalar(const char *text, size_t len, uint32_t *out);
+size_t json_structurals_sse2(const char *text, size_t len, uint32_t *out);
+
+/* Name of the kernel json_structurals dispatches to on this CPU */
+const char *json_structurals_impl();
+
+#endif
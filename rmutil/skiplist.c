@@ -0,0 +1,118 @@
+#include <string.h>
+#include "skiplist.h"
+
+static SkipListNode *createNode(int level, const char *key, size_t len, uint32_t id) {
+  SkipListNode *n = malloc(sizeof(SkipListNode) + level * sizeof(struct skipListLevel));
+  n->key = key;
+  n->len = len;
+  n->id = id;
+  return n;
+}
+
+/* Returns a level between 1 and SKIPLIST_MAXLEVEL, higher levels being less likely */
+static int randomLevel() {
+  int level = 1;
+  while ((random() & 0xFFFF) < (SKIPLIST_P * 0xFFFF)) level++;
+  return level < SKIPLIST_MAXLEVEL ? level : SKIPLIST_MAXLEVEL;
+}
+
+/* Compare the pair of a node with (key, id), bytes compare unsigned and a
+ * prefix sorts before the longer key */
+static int nodeCompare(const SkipListNode *n, const char *key, size_t len, uint32_t id) {
+  int cmp = memcmp(n->key, key, n->len < len ? n->len : len);
+  if (cmp != 0) return cmp;
+  if (n->len != len) return n->len < len ? -1 : 1;
+  return (n->id > id) - (n->id < id);
+}
+
+SkipList *NewSkipList() {
+  SkipList *sl = malloc(sizeof(SkipList));
+  sl->level = 1;
+  sl->length = 0;
+  sl->header = createNode(SKIPLIST_MAXLEVEL, NULL, 0, 0);
+  for (int i = 0; i < SKIPLIST_MAXLEVEL; i++) {
+    sl->header->level[i].forward = NULL;
+  }
+  sl->header->backward = NULL;
+  sl->tail = NULL;
+  return sl;
+}
+
+void SkipList_Free(SkipList *sl) {
+  SkipListNode *n = sl->header->level[0].forward, *next;
+  free(sl->header);
+  while (n) {
+    next = n->level[0].forward;
+    free(n);
+    n = next;
+  }
+  free(sl);
+}
+
+void SkipList_Insert(SkipList *sl, const char *key, size_t len, uint32_t id) {
+  SkipListNode *update[SKIPLIST_MAXLEVEL], *x = sl->header;
+  for (int i = sl->level - 1; i >= 0; i--) {
+    while (x->level[i].forward && nodeCompare(x->level[i].forward, key, len, id) < 0) {
+      x = x->level[i].forward;
+    }
+    update[i] = x;
+  }
+
+  int level = randomLevel();
+  if (level > sl->level) {
+    for (int i = sl->level; i < level; i++) {
+      update[i] = sl->header;
+    }
+    sl->level = level;
+  }
+
+  x = createNode(level, key, len, id);
+  for (int i = 0; i < level; i++) {
+    x->level[i].forward = update[i]->level[i].forward;
+    update[i]->level[i].forward = x;
+  }
+  x->backward = update[0] == sl->header ? NULL : update[0];
+  if (x->level[0].forward) {
+    x->level[0].forward->backward = x;
+  } else {
+    sl->tail = x;
+  }
+  sl->length++;
+}
+
+int SkipList_Delete(SkipList *sl, const char *key, size_t len, uint32_t id) {
+  SkipListNode *update[SKIPLIST_MAXLEVEL], *x = sl->header;
+  for (int i = sl->level - 1; i >= 0; i--) {
+    while (x->level[i].forward && nodeCompare(x->level[i].forward, key, len, id) < 0) {
+      x = x->level[i].forward;
+    }
+    update[i] = x;
+  }
+
+  x = x->level[0].forward;
+  if (x == NULL || nodeCompare(x, key, len, id) != 0) return 0;
+
+  for (int i = 0; i < sl->level; i++) {
+    if (update[i]->level[i].forward == x) {
+      update[i]->level[i].forward = x->level[i].forward;
+    }
+  }
+  if (x->level[0].forward) {
+    x->level[0].forward->backward = x->backward;
+  } else {
+    sl->tail = x->backward;
+  }
+  while (sl->level > 1 && sl->header->level[sl->level - 1].forward == NULL) {
+    sl->level--;
+  }
+  sl->length--;
+  free(x);
+  return 1;
+}
+
+size_t SkipList_MemUsage(SkipList *sl) {
+  // nodes have 1 / (1 - p) levels on average
+  return sizeof(SkipList) + sizeof(SkipListNode) +
+         SKIPLIST_MAXLEVEL * sizeof(struct skipListLevel) +
+         sl->length * (sizeof(SkipListNode) + sizeof(struct skipListLevel) / (1 - SKIPLIST_P));
+}
@@ -0,0 +1,55 @@
+#ifndef __SKIPLIST_H__
+#define __SKIPLIST_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SKIPLIST_MAXLEVEL 32
+#define SKIPLIST_P 0.25
+
+/*
+* An ordered set of (key, id) pairs, sorted by the key bytes and then by id,
+* like the sorted sets of redis. Keys are not copied, the caller must keep
+* them alive until their entry is deleted. The list is doubly linked at the
+* bottom level so it can be walked in both directions.
+*/
+typedef struct skipListNode {
+  const char *key;
+  size_t len;
+  uint32_t id;
+  struct skipListNode *backward;
+  struct skipListLevel {
+    struct skipListNode *forward;
+  } level[];
+} SkipListNode;
+
+typedef struct {
+  SkipListNode *header;
+  SkipListNode *tail;
+  size_t length;
+  int level;
+} SkipList;
+
+SkipList *NewSkipList();
+
+void SkipList_Free(SkipList *sl);
+
+/* Insert a pair, the caller must make sure it is not in the list already */
+void SkipList_Insert(SkipList *sl, const char *key, size_t len, uint32_t id);
+
+/* Delete a pair, returns 1 if it was found */
+int SkipList_Delete(SkipList *sl, const char *key, size_t len, uint32_t id);
+
+/* Approximate number of bytes used by the list */
+size_t SkipList_MemUsage(SkipList *sl);
+
+/* Walk the list in order.
+ * e.g.
+ *  for (SkipListNode *n = SkipList_First(sl); n; n = SkipListNode_Next(n)) { ... }
+ */
+#define SkipList_First(sl) ((sl)->header->level[0].forward)
+#define SkipList_Last(sl) ((sl)->tail)
+#define SkipListNode_Next(n) ((n)->level[0].forward)
+#define SkipListNode_Prev(n) ((n)->backward)
+
+#endif
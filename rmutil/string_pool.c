@@ -37,74 +37,146 @@
 #include <pthread.h>
 #include "string_pool.h"
 
-typedef struct Pair Pair;
-
-typedef struct Bucket Bucket;
-
-struct Pair {
-  char *key;
-};
-
-struct Bucket {
+/*
+ * The pool is split in SM_NUM_SHARDS shards picked by the top bits of the
+ * hash, each an open addressing table of entry pointers with its own lock.
+ * Entries are immutable once published, so lookups read the tables without
+ * locking: only a miss takes the lock of its shard to insert. A shard grows
+ * on its own when half full, the tables it outgrew are kept until the pool is
+ * deleted since readers may still be probing them.
+ */
+#define SM_NUM_SHARDS 16
+#define SM_SHARD_BITS 4
+#define SM_MIN_SLOTS 8
+
+typedef struct Entry {
+  unsigned int hash;
+  unsigned int len;
+  char key[];
+} Entry;
+
+typedef struct Table {
+  unsigned int mask;
+  struct Table *retired;  // the table this one replaced
+  Entry *slots[];
+} Table;
+
+typedef struct Shard {
+  Table *table;
   unsigned int count;
-  Pair *pairs;
-};
+  size_t memory;  // tables, outgrown ones included, and entries
+  pthread_mutex_t mutex;
+  char pad[64];
+} Shard;
 
 struct StringPool {
-  unsigned int count;
-  Bucket *buckets;
-  pthread_mutex_t mutex;
+  Shard shards[SM_NUM_SHARDS];
 };
 
-static Pair *get_pair(Bucket *bucket, const char *key);
 static unsigned int murMurHash(const void *key, int len);
 
+static Table *new_table(unsigned int size) {
+  Table *table = calloc(1, sizeof(Table) + size * sizeof(Entry *));
+  if (table == NULL) {
+    return NULL;
+  }
+  table->mask = size - 1;
+  return table;
+}
+
+/*
+ * Returns the entry of the table matching the key, or null. Slots are probed
+ * from the one the hash points to up to the first empty one.
+ */
+static Entry *find_entry(Table *table, const char *key, size_t len, unsigned int hash) {
+  unsigned int i = hash & table->mask;
+  Entry *entry;
+
+  while ((entry = __atomic_load_n(&table->slots[i], __ATOMIC_ACQUIRE)) != NULL) {
+    if (entry->hash == hash && entry->len == len && memcmp(entry->key, key, len) == 0) {
+      return entry;
+    }
+    i = (i + 1) & table->mask;
+  }
+  return NULL;
+}
+
+static void insert_entry(Table *table, Entry *entry) {
+  unsigned int i = entry->hash & table->mask;
+
+  while (table->slots[i] != NULL) {
+    i = (i + 1) & table->mask;
+  }
+  __atomic_store_n(&table->slots[i], entry, __ATOMIC_RELEASE);
+}
+
+/* Move the entries of a shard to a table twice as big, with its lock held */
+static int grow_shard(Shard *shard) {
+  Table *old = shard->table;
+  Table *table = new_table((old->mask + 1) * 2);
+  unsigned int i;
+
+  if (table == NULL) {
+    return -1;
+  }
+  for (i = 0; i <= old->mask; i++) {
+    if (old->slots[i] != NULL) {
+      insert_entry(table, old->slots[i]);
+    }
+  }
+  table->retired = old;
+  __atomic_store_n(&shard->table, table, __ATOMIC_RELEASE);
+  __atomic_store_n(&shard->memory,
+                   shard->memory + sizeof(Table) + (table->mask + 1) * sizeof(Entry *),
+                   __ATOMIC_RELAXED);
+  return 0;
+}
+
 StringPool *sm_new(unsigned int capacity) {
   StringPool *pool;
+  unsigned int size = SM_MIN_SLOTS, i;
 
-  pool = malloc(sizeof(StringPool));
-  if (pool == NULL) {
-    return NULL;
+  /* twice the share of each shard, they grow once half full */
+  while (size < capacity * 2 / SM_NUM_SHARDS) {
+    size *= 2;
   }
-  if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
-    sm_delete(pool);
+  pool = calloc(1, sizeof(StringPool));
+  if (pool == NULL) {
     return NULL;
   }
-  pool->count = capacity;
-  pool->buckets = malloc(pool->count * sizeof(Bucket));
-  if (pool->buckets == NULL) {
-    free(pool);
-    return NULL;
+  for (i = 0; i < SM_NUM_SHARDS; i++) {
+    pool->shards[i].table = new_table(size);
+    if (pool->shards[i].table == NULL || pthread_mutex_init(&pool->shards[i].mutex, NULL) != 0) {
+      sm_delete(pool);
+      return NULL;
+    }
+    pool->shards[i].memory = sizeof(Table) + size * sizeof(Entry *);
   }
-  memset(pool->buckets, 0, pool->count * sizeof(Bucket));
   return pool;
 }
 
 void sm_delete(StringPool *pool) {
-  unsigned int i, j, n, m;
-  Bucket *bucket;
-  Pair *pair;
+  unsigned int i, j;
+  Table *table, *retired;
 
   if (pool == NULL) {
     return;
   }
-  n = pool->count;
-  bucket = pool->buckets;
-  i = 0;
-  while (i < n) {
-    m = bucket->count;
-    pair = bucket->pairs;
-    j = 0;
-    while (j < m) {
-      free(pair->key);
-      pair++;
-      j++;
+  for (i = 0; i < SM_NUM_SHARDS; i++) {
+    table = pool->shards[i].table;
+    if (table == NULL) {
+      continue;
+    }
+    for (j = 0; j <= table->mask; j++) {
+      free(table->slots[j]);
+    }
+    while (table != NULL) {
+      retired = table->retired;
+      free(table);
+      table = retired;
     }
-    free(bucket->pairs);
-    bucket++;
-    i++;
+    pthread_mutex_destroy(&pool->shards[i].mutex);
   }
-  free(pool->buckets);
   free(pool);
 }
 
@@ -117,11 +189,11 @@ char *sm_put(StringPool *pool, const char *string) {
   }
   return sm_nput(pool, string, strlen(string));
 }
+
 char *sm_nput(StringPool *pool, const char *string, size_t key_len) {
-  unsigned int index;
-  Bucket *bucket;
-  Pair *tmp_pairs, *pair;
-  char *new_key = NULL;
+  unsigned int hash;
+  Shard *shard;
+  Entry *entry;
 
   if (pool == NULL) {
     return NULL;
@@ -129,112 +201,75 @@ char *sm_nput(StringPool *pool, const char *string, size_t key_len) {
   if (string == NULL) {
     return NULL;
   }
-  /* Get a pointer to the bucket the key string hashes to */
-  index = murMurHash(string, key_len) % pool->count;
-  bucket = &(pool->buckets[index]);
-  /* Check if we can handle insertion by simply replacing
-   * an existing value in a key-value pair in the bucket.
-   */
-  if ((pair = get_pair(bucket, string)) != NULL) {
-    return pair->key;
+  hash = murMurHash(string, key_len);
+  shard = &pool->shards[hash >> (32 - SM_SHARD_BITS)];
+  entry = find_entry(__atomic_load_n(&shard->table, __ATOMIC_ACQUIRE), string, key_len, hash);
+  if (entry != NULL) {
+    return entry->key;
   }
 
-  pthread_mutex_lock(&pool->mutex);
-  if ((pair = get_pair(bucket, string)) != NULL) {
-    pthread_mutex_unlock(&pool->mutex);
-    return pair->key;
+  pthread_mutex_lock(&shard->mutex);
+  /* another thread may have added it, or grown the table, since the lookup */
+  entry = find_entry(shard->table, string, key_len, hash);
+  if (entry != NULL) {
+    goto unlock;
   }
-  /* Allocate space for a new key */
-  new_key = malloc((key_len + 1) * sizeof(char));
-  if (new_key == NULL) {
+  if ((shard->count + 1) * 2 > shard->table->mask + 1 && grow_shard(shard) != 0) {
     goto unlock;
   }
-  /* Create a key-value pair */
-  if (bucket->count == 0) {
-    /* The bucket is empty, lazily allocate space for a single
-     * key-value pair.
-     */
-    bucket->pairs = malloc(sizeof(Pair));
-    if (bucket->pairs == NULL) {
-      free(new_key);
-      goto unlock;
-    }
-    bucket->count = 1;
-  } else {
-    /* The bucket wasn't empty but no pair existed that matches the provided
-     * key, so create a new key-value pair.
-     */
-    tmp_pairs = realloc(bucket->pairs, (bucket->count + 1) * sizeof(Pair));
-    if (tmp_pairs == NULL) {
-      free(new_key);
-      goto unlock;
-    }
-    bucket->pairs = tmp_pairs;
-    bucket->count++;
+  entry = malloc(sizeof(Entry) + key_len + 1);
+  if (entry == NULL) {
+    goto unlock;
   }
-  /* Get the last pair in the chain for the bucket */
-  pair = &(bucket->pairs[bucket->count - 1]);
-  pair->key = new_key;
-  /* Copy the key and its value into the key-value pair */
-  strncpy(pair->key, string, key_len);
+  entry->hash = hash;
+  entry->len = key_len;
+  memcpy(entry->key, string, key_len);
+  entry->key[key_len] = '\0';
+  insert_entry(shard->table, entry);
+  __atomic_store_n(&shard->count, shard->count + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&shard->memory, shard->memory + sizeof(Entry) + key_len + 1, __ATOMIC_RELAXED);
 unlock:
-  pthread_mutex_unlock(&pool->mutex);
-  return new_key;
+  pthread_mutex_unlock(&shard->mutex);
+  return entry ? entry->key : NULL;
 }
 
-int sm_get_count(const StringPool *pool) {
-  unsigned int i, j, n, m;
-  unsigned int count;
-  Bucket *bucket;
-  Pair *pair;
+char *sm_nget(StringPool *pool, const char *string, size_t key_len) {
+  unsigned int hash;
+  Shard *shard;
+  Entry *entry;
+
+  if (pool == NULL || string == NULL) {
+    return NULL;
+  }
+  hash = murMurHash(string, key_len);
+  shard = &pool->shards[hash >> (32 - SM_SHARD_BITS)];
+  entry = find_entry(__atomic_load_n(&shard->table, __ATOMIC_ACQUIRE), string, key_len, hash);
+  return entry ? entry->key : NULL;
+}
+
+size_t sm_mem_usage(const StringPool *pool) {
+  unsigned int i;
+  size_t memory = sizeof(StringPool);
 
   if (pool == NULL) {
     return 0;
   }
-  bucket = pool->buckets;
-  n = pool->count;
-  i = 0;
-  count = 0;
-  while (i < n) {
-    pair = bucket->pairs;
-    m = bucket->count;
-    j = 0;
-    while (j < m) {
-      count++;
-      pair++;
-      j++;
-    }
-    bucket++;
-    i++;
+  for (i = 0; i < SM_NUM_SHARDS; i++) {
+    memory += __atomic_load_n(&pool->shards[i].memory, __ATOMIC_RELAXED);
   }
-  return count;
+  return memory;
 }
 
-/*
- * Returns a pair from the bucket that matches the provided key,
- * or null if no such pair exist.
- */
-static Pair *get_pair(Bucket *bucket, const char *key) {
-  unsigned int i, n;
-  Pair *pair;
+int sm_get_count(const StringPool *pool) {
+  unsigned int i, count = 0;
 
-  n = bucket->count;
-  if (n == 0) {
-    return NULL;
+  if (pool == NULL) {
+    return 0;
   }
-  pair = bucket->pairs;
-  if (n == 1) return pair;
-  i = 0;
-  while (i < n) {
-    if (pair->key != NULL) {
-      if (strcmp(pair->key, key) == 0) {
-        return pair;
-      }
-    }
-    pair++;
-    i++;
+  for (i = 0; i < SM_NUM_SHARDS; i++) {
+    count += __atomic_load_n(&pool->shards[i].count, __ATOMIC_RELAXED);
   }
-  return NULL;
+  return count;
 }
 
 static unsigned int murMurHash(const void *key, int len) {
@@ -245,7 +280,8 @@ static unsigned int murMurHash(const void *key, int len) {
   // Mix 4 bytes at a time into the hash
   const unsigned char *data = (const unsigned char *)key;
   while (len >= 4) {
-    unsigned int k = *(unsigned int *)data;
+    unsigned int k;
+    memcpy(&k, data, sizeof(k));
     k *= m;
     k ^= k >> r;
     k *= m;
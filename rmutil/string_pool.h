@@ -51,8 +51,8 @@ typedef struct StringPool StringPool;
  *
  * Parameters:
  *
- * capacity: The number of top-level slots this string map
- * should allocate. This parameter must be > 0.
+ * capacity: The number of strings the pool is expected to hold.
+ * It grows past it as needed.
  *
  * Return value: A pointer to a string map object,
  * or null if a new string map could not be allocated.
@@ -80,15 +80,26 @@ void sm_delete(StringPool *pool);
  * map: A pointer to a string map. This parameter cannot be null.
  *
  * string: A pointer to a null-terminated C string. This parameter
- * cannot be null. The string must have a string length > 0. The
- * string will be copied.
+ * cannot be null. The string will be copied.
  *
- * Return value: the interned string.
+ * Return value: the interned string, null-terminated and valid until the
+ * pool is deleted, or null if it could not be allocated.
+ *
+ * Threads may add strings concurrently. Strings already in the pool are
+ * found without taking any lock.
  */
 char *sm_put(StringPool *pool, const char *string);
 
+/* sm_put for the len first bytes of string, which needs no null terminator */
 char *sm_nput(StringPool *pool, const char *string, size_t len);
 
+/*
+ * Returns the interned copy of the len first bytes of string if it is in
+ * the pool, or null. Nothing is added, so strings from untrusted input can
+ * be looked up without growing the pool. Never takes a lock.
+ */
+char *sm_nget(StringPool *pool, const char *string, size_t len);
+
 /*
  * Returns the number of string in the pool.
  *
@@ -100,6 +111,12 @@ char *sm_nput(StringPool *pool, const char *string, size_t len);
  */
 int sm_get_count(const StringPool *pool);
 
+/*
+ * Returns the bytes held by the pool: its strings, its tables and the
+ * tables it outgrew.
+ */
+size_t sm_mem_usage(const StringPool *pool);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,45 @@
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+#include "test.h"
+
+int testArena() {
+  Arena *a = NewArena(1024);
+  ASSERT_EQUAL(sizeof(Arena), Arena_MemUsage(a));
+
+  // small allocations share a block and are aligned
+  char *first = Arena_Alloc(a, 10);
+  char *second = Arena_Alloc(a, 3);
+  ASSERT_EQUAL(16, (double)(second - first));
+  ASSERT_EQUAL(0, (double)((uintptr_t)second % 16));
+  memset(first, 'x', 10);
+  memset(second, 'y', 3);
+
+  // a big one gets its own block and the small ones keep filling the current one
+  char *big = Arena_Alloc(a, 4000);
+  memset(big, 'z', 4000);
+  char *third = Arena_Alloc(a, 16);
+  ASSERT_EQUAL(32, (double)(third - first));
+  ASSERT_EQUAL(16 + 16 + 4000 + 16, a->allocated);
+
+  // filling the block starts a new one
+  for (int i = 0; i < 100; i++) {
+    char *p = Arena_Alloc(a, 32);
+    memset(p, i, 32);
+  }
+  ASSERT_EQUAL('x', first[9]);
+  ASSERT_EQUAL('y', second[2]);
+
+  Arena_Reset(a);
+  ASSERT_EQUAL(0, a->allocated);
+  ASSERT(a->blocks != NULL);
+  ASSERT(a->blocks->next == NULL);
+  ASSERT_EQUAL(sizeof(Arena) + sizeof(ArenaBlock) + 1024, Arena_MemUsage(a));
+
+  char *again = Arena_Alloc(a, 8);
+  ASSERT(again == a->blocks->data);
+  Arena_Free(a);
+  return 0;
+}
+
+TEST_MAIN({ TESTFUNC(testArena); });
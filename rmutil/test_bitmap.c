@@ -0,0 +1,60 @@
+#include "bitmap.h"
+#include <stdio.h>
+#include "test.h"
+
+int testBitmap() {
+  Bitmap *bm = NewBitmap();
+  ASSERT(bm != NULL);
+
+  // enough values in the first container to switch it to a bitset
+  for (uint32_t i = 0; i < 10000; i += 2) {
+    ASSERT_EQUAL(1, Bitmap_Add(bm, i));
+  }
+  ASSERT_EQUAL(0, Bitmap_Add(bm, 0));
+  ASSERT_EQUAL(1, Bitmap_Add(bm, 1 << 20));
+  ASSERT_EQUAL(5001, Bitmap_Cardinality(bm));
+  ASSERT_EQUAL(BITMAP_CONTAINER_BITSET, bm->containers[0].type);
+
+  ASSERT(Bitmap_Contains(bm, 9998));
+  ASSERT(!Bitmap_Contains(bm, 9999));
+  ASSERT(Bitmap_Contains(bm, 1 << 20));
+
+  ASSERT_EQUAL(1, Bitmap_Remove(bm, 1 << 20));
+  ASSERT_EQUAL(0, Bitmap_Remove(bm, 1 << 20));
+  ASSERT_EQUAL(1, bm->size);
+
+  BitmapIterator it = Bitmap_Iterate(bm);
+  uint32_t v, expected = 0;
+  while (BitmapIterator_Next(&it, &v)) {
+    ASSERT_EQUAL(expected, v);
+    expected += 2;
+  }
+  ASSERT_EQUAL(10000, expected);
+
+  Bitmap *other = NewBitmap();
+  for (uint32_t i = 0; i < 100; i += 3) {
+    Bitmap_Add(other, i);
+  }
+  Bitmap *and = Bitmap_And(bm, other);
+  // multiples of 6 below 100
+  ASSERT_EQUAL(17, Bitmap_Cardinality(and));
+  ASSERT(Bitmap_Contains(and, 96));
+
+  Bitmap *copy = Bitmap_Copy(bm);
+  Bitmap_AndInPlace(copy, other);
+  ASSERT_EQUAL(17, Bitmap_Cardinality(copy));
+  ASSERT_EQUAL(BITMAP_CONTAINER_ARRAY, copy->containers[0].type);
+
+  for (uint32_t i = 0; i < 10000; i += 2) {
+    Bitmap_Remove(bm, i);
+  }
+  ASSERT_EQUAL(0, Bitmap_Cardinality(bm));
+
+  Bitmap_Free(bm);
+  Bitmap_Free(other);
+  Bitmap_Free(and);
+  Bitmap_Free(copy);
+  return 0;
+}
+
+TEST_MAIN({ TESTFUNC(testBitmap); });
@@ -0,0 +1,61 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "casestr.h"
+#include "test.h"
+
+/* The tolower based search the kernels replace */
+static const char *naive(const char *hay, size_t n, const char *needle, size_t m) {
+  for (size_t i = 0; i + m <= n; i++) {
+    size_t j = 0;
+    while (j < m && tolower(hay[i + j]) == tolower(needle[j])) j++;
+    if (j == m) return hay + i;
+  }
+  return NULL;
+}
+
+typedef const char *(*finder)(const char *, size_t, const char *, size_t);
+
+int testCaseStrBasic() {
+  finder kernels[] = {casestr_find_scalar, casestr_find_sse2, casestr_find};
+  const char *hay = "Engineering Department";
+  for (int k = 0; k < 3; k++) {
+    ASSERT(kernels[k](hay, strlen(hay), "ENGIN", 5) == hay);
+    ASSERT(kernels[k](hay, strlen(hay), "ment", 4) == hay + 18);
+    ASSERT(kernels[k](hay, strlen(hay), "t", 1) == hay + 17);
+    ASSERT(kernels[k](hay, strlen(hay), "", 0) == hay);
+    ASSERT(kernels[k](hay, strlen(hay), "ments", 5) == NULL);
+    ASSERT(kernels[k](hay, 3, "Engin", 5) == NULL);
+    // '@' and '`' differ by the case bit but are not letters
+    ASSERT(kernels[k]("a@b", 3, "A`B", 3) == NULL);
+    ASSERT(kernels[k]("x[y", 3, "X{Y", 3) == NULL);
+  }
+  return 0;
+}
+
+int testCaseStrRandom() {
+  // a small alphabet with both cases and the bytes next to the letters makes
+  // partial matches frequent
+  const char alphabet[] = "aAbB@[`{ zZ";
+  char buf[512], needle[8];
+  finder kernels[] = {casestr_find_scalar, casestr_find_sse2, casestr_find};
+  srand(42);
+  for (int iter = 0; iter < 200000; iter++) {
+    // some haystacks are long enough for casestr_find to take AVX2
+    size_t n = rand() % 4 ? rand() % 80 : 256 + rand() % 128, m = rand() % 6, off = rand() % 64;
+    char *hay = buf + off;
+    for (size_t i = 0; i < n; i++) hay[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+    for (size_t i = 0; i < m; i++) needle[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+    const char *expected = naive(hay, n, needle, m);
+    for (int k = 0; k < 3; k++) {
+      ASSERT(kernels[k](hay, n, needle, m) == expected);
+    }
+  }
+  return 0;
+}
+
+TEST_MAIN({
+  printf("Using the %s kernel\n", casestr_impl());
+  TESTFUNC(testCaseStrBasic);
+  TESTFUNC(testCaseStrRandom);
+});
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "column.h"
+#include "test.h"
+
+int testColumn() {
+  Column *c = NewColumn();
+  size_t len;
+  ASSERT(Column_Get(c, 0, &len) == NULL);
+
+  Column_Set(c, 3, "Sales", 5);
+  Column_Set(c, 0, "HR", 2);
+  Column_Set(c, 40, "", 0);
+  ASSERT(Column_Get(c, 1, &len) == NULL);
+  ASSERT(Column_Get(c, 3, &len) != NULL);
+  ASSERT_EQUAL(5, len);
+  ASSERT(!memcmp(Column_Get(c, 3, &len), "Sales", 5));
+  ASSERT(Column_Get(c, 40, &len) != NULL);
+  ASSERT_EQUAL(0, len);
+
+  // the code of a value no row holds anymore is freed
+  Column_Set(c, 3, "Legal", 5);
+  ASSERT(Column_IsEncoded(c));
+  ASSERT_EQUAL(3, Dict_Size(c->codeOf));
+  ASSERT(!memcmp(Column_Get(c, 3, &len), "Legal", 5));
+  Column_Delete(c, 0);
+  ASSERT(Column_Get(c, 0, &len) == NULL);
+
+  Bitmap *out = NewBitmap();
+  Column_FindCase(c, "LEG", 3, out);
+  ASSERT_EQUAL(1, Bitmap_Cardinality(out));
+  ASSERT(Bitmap_Contains(out, 3));
+  Bitmap_Free(out);
+
+  // the replaced value no longer matches
+  out = NewBitmap();
+  Column_FindCase(c, "sal", 3, out);
+  ASSERT_EQUAL(0, Bitmap_Cardinality(out));
+  Bitmap_Free(out);
+
+  out = NewBitmap();
+  Column_FindCase(c, "", 0, out);
+  ASSERT_EQUAL(2, Bitmap_Cardinality(out));
+  Bitmap_Free(out);
+
+  out = NewBitmap();
+  Column_Equals(c, "", 0, out);
+  ASSERT_EQUAL(1, Bitmap_Cardinality(out));
+  ASSERT(Bitmap_Contains(out, 40));
+  Bitmap_Free(out);
+
+  Column_Free(c);
+  return 0;
+}
+
+static const char *words[] = {"Sales", "sales", "Engineering", "HR", "Support", "", "legal", "hr"};
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+#define NUM_ROWS 2000
+
+/* Set value to one of distinct values built from the words */
+static void randomValue(char *value, int distinct) {
+  int n = rand() % distinct;
+  if (n < (int)NUM_WORDS) {
+    strcpy(value, words[n]);
+  } else {
+    sprintf(value, "%s%d", words[n % NUM_WORDS], n);
+  }
+}
+
+static char expected[NUM_ROWS][32];
+static int has[NUM_ROWS];
+
+/* Compare the scans to a row by row check while rows are set, replaced and
+ * deleted at random */
+static int checkRandom(Column *c, int distinct, int rounds) {
+  char needle[32];
+
+  for (int round = 0; round < rounds; round++) {
+    for (int i = 0; i < 400; i++) {
+      uint32_t row = rand() % NUM_ROWS;
+      if (rand() % 4 == 0) {
+        Column_Delete(c, row);
+        has[row] = 0;
+      } else {
+        randomValue(expected[row], distinct);
+        has[row] = 1;
+        Column_Set(c, row, expected[row], strlen(expected[row]));
+      }
+    }
+
+    randomValue(needle, distinct);
+    size_t n = strlen(needle) > 2 ? 2 + rand() % (strlen(needle) - 2) : strlen(needle);
+    Bitmap *found = NewBitmap(), *equal = NewBitmap();
+    Column_FindCase(c, needle, n, found);
+    Column_Equals(c, needle, strlen(needle), equal);
+
+    for (uint32_t row = 0; row < NUM_ROWS; row++) {
+      int contains = 0;
+      for (size_t i = 0; has[row] && i + n <= strlen(expected[row]); i++) {
+        contains |= !strncasecmp(expected[row] + i, needle, n);
+      }
+      int same = has[row] && !strcmp(expected[row], needle);
+      ASSERT_EQUAL(contains, Bitmap_Contains(found, row));
+      ASSERT_EQUAL(same, Bitmap_Contains(equal, row));
+    }
+    Bitmap_Free(found);
+    Bitmap_Free(equal);
+  }
+  return 0;
+}
+
+/* A few distinct values stay dictionary encoded */
+int testColumnRandom() {
+  Column *c = NewColumn();
+  memset(has, 0, sizeof(has));
+  srand(7);
+  if (checkRandom(c, NUM_WORDS, 200)) return -1;
+  ASSERT(Column_IsEncoded(c));
+  Column_Free(c);
+  return 0;
+}
+
+/* Too many distinct values move the column to the heap, which then goes
+ * through many compactions */
+int testColumnPlain() {
+  Column *c = NewColumn();
+  memset(has, 0, sizeof(has));
+  srand(11);
+  if (checkRandom(c, 100, 5)) return -1;
+  ASSERT(Column_IsEncoded(c));
+  if (checkRandom(c, 1000, 200)) return -1;
+  ASSERT(!Column_IsEncoded(c));
+  ASSERT(c->garbage * 2 <= c->heapLen || c->heapLen < 4096);
+  Column_Free(c);
+  return 0;
+}
+
+TEST_MAIN({
+  TESTFUNC(testColumn);
+  TESTFUNC(testColumnRandom);
+  TESTFUNC(testColumnPlain);
+});
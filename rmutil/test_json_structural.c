@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json_structural.h"
+#include "test.h"
+
+typedef size_t (*kernel)(const char *, size_t, uint32_t *);
+
+int testStructuralsBasic() {
+  kernel kernels[] = {json_structurals_scalar, json_structurals_sse2, json_structurals};
+  const char *doc = "{\"a\\\"b\": \"x,y\", \"c\":[1,{\"d\":\"\\\\\"}]}";
+  uint32_t expected[] = {0,  1,  3,  6,  7,  9,  13, 14, 16, 18, 19,
+                         20, 22, 23, 24, 26, 27, 28, 29, 31, 32, 33, 34};
+  uint32_t out[64];
+  for (int k = 0; k < 3; k++) {
+    size_t n = kernels[k](doc, strlen(doc), out);
+    ASSERT_EQUAL(sizeof(expected) / sizeof(expected[0]), n);
+    for (size_t i = 0; i < n; i++) {
+      ASSERT_EQUAL(expected[i], out[i]);
+    }
+    ASSERT_EQUAL(0, kernels[k]("", 0, out));
+    ASSERT_EQUAL(JSON_STRUCTURAL_NUL, kernels[k]("{\"a\0\"}", 6, out));
+  }
+  return 0;
+}
+
+int testStructuralsRandom() {
+  // JSON characters only, so strings, escapes and runs of backslashes are frequent and cross the
+  // 64 byte blocks
+  const char alphabet[] = "\"\\\\{}[]:, ab";
+  char buf[400];
+  uint32_t expected[400], out[400];
+  kernel kernels[] = {json_structurals_sse2, json_structurals};
+  srand(42);
+  for (int iter = 0; iter < 100000; iter++) {
+    size_t len = rand() % 300;
+    for (size_t i = 0; i < len; i++) buf[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+    if (rand() % 50 == 0 && len > 0) buf[rand() % len] = '\0';
+    size_t n = json_structurals_scalar(buf, len, expected);
+    for (int k = 0; k < 2; k++) {
+      ASSERT_EQUAL(n, kernels[k](buf, len, out));
+      if (n == JSON_STRUCTURAL_NUL) continue;
+      ASSERT(memcmp(expected, out, n * sizeof(uint32_t)) == 0);
+    }
+  }
+  return 0;
+}
+
+TEST_MAIN({
+  printf("Using the %s kernel\n", json_structurals_impl());
+  TESTFUNC(testStructuralsBasic);
+  TESTFUNC(testStructuralsRandom);
+});
@@ -0,0 +1,41 @@
+#include "skiplist.h"
+#include <stdio.h>
+#include <string.h>
+#include "test.h"
+
+int testSkipList() {
+  SkipList *sl = NewSkipList();
+  ASSERT(sl != NULL);
+  ASSERT(SkipList_First(sl) == NULL);
+
+  const char *keys[] = {"bob", "alice", "carol", "al", "bob"};
+  for (uint32_t i = 0; i < 5; i++) {
+    SkipList_Insert(sl, keys[i], strlen(keys[i]), i);
+  }
+  ASSERT_EQUAL(5, sl->length);
+
+  // by key, then by id for equal keys
+  uint32_t order[] = {3, 1, 0, 4, 2};
+  int n = 0;
+  for (SkipListNode *x = SkipList_First(sl); x; x = SkipListNode_Next(x)) {
+    ASSERT_EQUAL(order[n], x->id);
+    n++;
+  }
+  ASSERT_EQUAL(5, n);
+  for (SkipListNode *x = SkipList_Last(sl); x; x = SkipListNode_Prev(x)) {
+    n--;
+    ASSERT_EQUAL(order[n], x->id);
+  }
+
+  ASSERT_EQUAL(0, SkipList_Delete(sl, "bob", 3, 1));
+  ASSERT_EQUAL(1, SkipList_Delete(sl, "bob", 3, 4));
+  ASSERT_EQUAL(1, SkipList_Delete(sl, "carol", 5, 2));
+  ASSERT_EQUAL(3, sl->length);
+  ASSERT_EQUAL(0, SkipList_Last(sl)->id);
+  ASSERT_EQUAL(3, SkipList_First(sl)->id);
+
+  SkipList_Free(sl);
+  return 0;
+}
+
+TEST_MAIN({ TESTFUNC(testSkipList); });
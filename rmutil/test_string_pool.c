@@ -0,0 +1,93 @@
+#include <pthread.h>
+#include <stdio.h>
+#include "string_pool.h"
+#include "test.h"
+
+#define NUM_KEYS 10000
+#define NUM_THREADS 4
+
+int testPut() {
+  StringPool *pool = sm_new(4);
+  char *a = sm_put(pool, "name");
+  ASSERT_STRING_EQ("name", a);
+  ASSERT(a == sm_put(pool, "name"));
+  ASSERT(a != sm_put(pool, "department"));
+  ASSERT_EQUAL(2, sm_get_count(pool));
+
+  // keys need no terminator and are compared on their length
+  ASSERT(a == sm_nput(pool, "names", 4));
+  char *n = sm_nput(pool, "names", 1);
+  ASSERT_STRING_EQ("n", n);
+  ASSERT(n != a);
+  ASSERT(sm_nput(pool, "", 0) == sm_put(pool, ""));
+  ASSERT_EQUAL(4, sm_get_count(pool));
+
+  // lookups don't add anything
+  size_t mem = sm_mem_usage(pool);
+  ASSERT(sm_nget(pool, "name", 4) == a);
+  ASSERT(sm_nget(pool, "named", 4) == a);
+  ASSERT(sm_nget(pool, "salary", 6) == NULL);
+  ASSERT_EQUAL(4, sm_get_count(pool));
+  ASSERT_EQUAL(mem, sm_mem_usage(pool));
+  sm_put(pool, "salary");
+  ASSERT(sm_mem_usage(pool) > mem);
+  sm_delete(pool);
+  return 0;
+}
+
+int testGrow() {
+  StringPool *pool = sm_new(4);
+  char *interned[NUM_KEYS];
+  char key[32];
+  for (int i = 0; i < NUM_KEYS; i++) {
+    sprintf(key, "key%d", i);
+    interned[i] = sm_put(pool, key);
+  }
+  ASSERT_EQUAL(NUM_KEYS, sm_get_count(pool));
+  for (int i = 0; i < NUM_KEYS; i++) {
+    sprintf(key, "key%d", i);
+    ASSERT(interned[i] == sm_put(pool, key));
+    ASSERT_STRING_EQ(key, interned[i]);
+  }
+  sm_delete(pool);
+  return 0;
+}
+
+static StringPool *shared;
+static char *found[NUM_THREADS][NUM_KEYS];
+
+static void *putAll(void *arg) {
+  char **out = arg;
+  char key[32];
+  for (int i = 0; i < NUM_KEYS; i++) {
+    sprintf(key, "field%d", i);
+    out[i] = sm_put(shared, key);
+  }
+  return NULL;
+}
+
+int testConcurrentPut() {
+  pthread_t threads[NUM_THREADS];
+  shared = sm_new(16);
+  for (int t = 0; t < NUM_THREADS; t++) {
+    pthread_create(&threads[t], NULL, putAll, found[t]);
+  }
+  for (int t = 0; t < NUM_THREADS; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  ASSERT_EQUAL(NUM_KEYS, sm_get_count(shared));
+  for (int i = 0; i < NUM_KEYS; i++) {
+    for (int t = 1; t < NUM_THREADS; t++) {
+      ASSERT(found[t][i] == found[0][i]);
+    }
+  }
+  sm_delete(shared);
+  return 0;
+}
+
+TEST_MAIN({
+  TESTFUNC(testPut);
+  TESTFUNC(testGrow);
+  TESTFUNC(testConcurrentPut);
+});
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "thread_pool.h"
+#include "test.h"
+
+#define NUM_PRODUCERS 4
+#define WORK_PER_PRODUCER 200000
+
+static long done = 0;
+
+static void *count(void *arg) {
+  __sync_fetch_and_add(&done, (long)arg);
+  return NULL;
+}
+
+static void *produce(void *arg) {
+  for (int i = 0; i < WORK_PER_PRODUCER; i++) {
+    // the ring is bounded, back off while the workers catch up
+    while (tpool_add_work(count, (void *)1) != 0) usleep(10);
+  }
+  return NULL;
+}
+
+static int gate = 0;
+
+static void *block(void *arg) {
+  while (!__sync_fetch_and_add(&gate, 0)) usleep(100);
+  return NULL;
+}
+
+static void sum(void *arg, int i) {
+  __sync_fetch_and_add((long *)arg, i);
+}
+
+int testThreadPool() {
+  pthread_t producers[NUM_PRODUCERS];
+  for (int i = 0; i < NUM_PRODUCERS; i++) {
+    pthread_create(&producers[i], NULL, produce, NULL);
+  }
+  for (int i = 0; i < NUM_PRODUCERS; i++) {
+    pthread_join(producers[i], NULL);
+  }
+  while (__sync_fetch_and_add(&done, 0) < NUM_PRODUCERS * WORK_PER_PRODUCER) usleep(100);
+  ASSERT_EQUAL(NUM_PRODUCERS * WORK_PER_PRODUCER, done);
+
+  long total = 0;
+  ASSERT_EQUAL(0, tpool_run_parallel(100, sum, &total));
+  ASSERT_EQUAL(4950, total);
+
+  // with every worker stuck the ring fills up
+  for (int i = 0; i < tpool_num_threads(); i++) {
+    ASSERT_EQUAL(0, tpool_add_work(block, NULL));
+  }
+  usleep(10000);
+  for (int i = 0; i < TPOOL_QUEUE_SIZE; i++) {
+    ASSERT_EQUAL(0, tpool_add_work(count, (void *)1));
+  }
+  ASSERT(tpool_add_work(count, (void *)1) != 0);
+  __sync_fetch_and_add(&gate, 1);
+  while (__sync_fetch_and_add(&done, 0) < NUM_PRODUCERS * WORK_PER_PRODUCER + TPOOL_QUEUE_SIZE) {
+    usleep(100);
+  }
+  return 0;
+}
+
+int testThreadPoolResize() {
+  long before = __sync_fetch_and_add(&done, 0);
+  ASSERT_EQUAL(0, tpool_resize(8));
+  ASSERT_EQUAL(8, tpool_num_threads());
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQUAL(0, tpool_add_work(count, (void *)1));
+  }
+  // work queued before and after shrinking is all run
+  ASSERT_EQUAL(0, tpool_resize(2));
+  ASSERT_EQUAL(2, tpool_num_threads());
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_EQUAL(0, tpool_add_work(count, (void *)1));
+  }
+  while (__sync_fetch_and_add(&done, 0) < before + 2000) usleep(100);
+
+  long total = 0;
+  ASSERT_EQUAL(0, tpool_run_parallel(100, sum, &total));
+  ASSERT_EQUAL(4950, total);
+
+  ASSERT_EQUAL(0, tpool_resize(4));
+  ASSERT(tpool_resize(0) != 0);
+  ASSERT_EQUAL(4, tpool_num_threads());
+  return 0;
+}
+
+static char order[64];
+static int numOrdered = 0;
+
+static void *record(void *arg) {
+  order[__sync_fetch_and_add(&numOrdered, 1)] = (char)(long)arg;
+  return NULL;
+}
+
+int testThreadPoolPriority() {
+  // a single worker, stuck until both lanes are filled
+  ASSERT_EQUAL(0, tpool_resize(1));
+  usleep(10000);
+  gate = 0;
+  ASSERT_EQUAL(0, tpool_add_work(block, NULL));
+  usleep(10000);
+  for (int i = 0; i < 24; i++) {
+    ASSERT_EQUAL(0, tpool_add_work_prio(record, (void *)'L', TPOOL_PRIO_LOW));
+  }
+  for (int i = 0; i < 24; i++) {
+    ASSERT_EQUAL(0, tpool_add_work_prio(record, (void *)'H', TPOOL_PRIO_HIGH));
+  }
+  ASSERT_EQUAL(48, tpool_queue_depth());
+  __sync_fetch_and_add(&gate, 1);
+  while (__sync_fetch_and_add(&numOrdered, 0) < 48) usleep(100);
+
+  // high work goes first, but low work gets a turn every TPOOL_LOW_SHARE works
+  int high = 0, low = 0;
+  for (int i = 0; i < 24; i++) {
+    if (order[i] == 'H') high++;
+    else low++;
+  }
+  ASSERT(high > low);
+  ASSERT(low >= 24 / TPOOL_LOW_SHARE - 1);
+  ASSERT_EQUAL(0, tpool_queue_depth());
+  return 0;
+}
+
+static int helpedDepth = -1;
+static int fannedOut = 0;
+
+static void probe(void *arg, int i) {
+  if (i == 0) helpedDepth = tpool_queue_depth();
+}
+
+static void *fanOut(void *arg) {
+  tpool_run_parallel(2, probe, NULL);
+  __sync_fetch_and_add(&fannedOut, 1);
+  return NULL;
+}
+
+int testThreadPoolHelpers() {
+  // one worker stuck, so the helper of the other one stays queued
+  ASSERT_EQUAL(0, tpool_resize(2));
+  usleep(10000);
+  gate = 0;
+  ASSERT_EQUAL(0, tpool_add_work(block, NULL));
+  usleep(10000);
+  ASSERT_EQUAL(0, tpool_add_work(fanOut, NULL));
+  while (!__sync_fetch_and_add(&fannedOut, 0)) usleep(100);
+  ASSERT_EQUAL(0, helpedDepth);
+  ASSERT_EQUAL(0, tpool_queue_depth());
+  __sync_fetch_and_add(&gate, 1);
+  return 0;
+}
+
+TEST_MAIN({
+  tpool_create(4, TPOOL_QUEUE_SIZE);
+  TESTFUNC(testThreadPool);
+  TESTFUNC(testThreadPoolResize);
+  TESTFUNC(testThreadPoolPriority);
+  TESTFUNC(testThreadPoolHelpers);
+  tpool_destroy();
+});
@@ -3,37 +3,187 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #include "thread_pool.h"
 
 static tpool_t *tpool = NULL;
 
+typedef struct {
+  void (*routine)(void *, int);
+  void *arg;
+  int n;
+  int next;
+  int done;
+  int refcount;  // the caller and the helpers, late helpers may outlive the caller
+  pthread_mutex_t lock;
+  pthread_cond_t finished;
+} tpool_parallel_t;
+
+// lane of the work a pool thread is running, which its helpers inherit
+static __thread int current_prio = TPOOL_PRIO_HIGH;
+
+static int queue_init(tpool_queue_t *q, int queue_size) {
+  unsigned long size, i;
+
+  for (size = 1; size < (unsigned long)queue_size; size <<= 1)
+    ;
+  q->slots = malloc(size * sizeof(tpool_work_t));
+  if (!q->slots) {
+    return -1;
+  }
+  q->mask = size - 1;
+  for (i = 0; i < size; ++i) {
+    q->slots[i].seq = i;
+  }
+  return 0;
+}
+
+/* Take the oldest work of the ring, returns 0 if it is empty */
+static int queue_pop(tpool_queue_t *q, void *(**routine)(void *), void **arg) {
+  tpool_work_t *slot;
+  unsigned long pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+  long diff;
+
+  while (1) {
+    slot = &q->slots[pos & q->mask];
+    diff = (long)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (long)(pos + 1);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return 0;
+    } else {
+      pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  *routine = slot->routine;
+  *arg = slot->arg;
+  // hand the slot to the producer of the next lap
+  __atomic_store_n(&slot->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/* Queue work in the ring, returns -1 if it is full */
+static int queue_push(tpool_queue_t *q, void *(*routine)(void *), void *arg) {
+  tpool_work_t *slot;
+  unsigned long pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+  long diff;
+
+  while (1) {
+    slot = &q->slots[pos & q->mask];
+    diff = (long)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (long)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return -1;
+    } else {
+      pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->routine = routine;
+  slot->arg = arg;
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static int queue_depth(tpool_queue_t *q) {
+  // dequeue_pos first, enqueue_pos can only have grown past it since
+  unsigned long deq = __atomic_load_n(&q->dequeue_pos, __ATOMIC_SEQ_CST);
+  unsigned long enq = __atomic_load_n(&q->enqueue_pos, __ATOMIC_SEQ_CST);
+  return (int)(enq - deq);
+}
+
+static int queues_empty() {
+  int prio;
+  for (prio = 0; prio < TPOOL_NUM_PRIO; ++prio) {
+    if (queue_depth(&tpool->queues[prio]) > 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Take the next work, from the high lane unless it is the turn of the low one */
+static int queues_pop(void *(**routine)(void *), void **arg, int *prio) {
+  unsigned long n = __atomic_add_fetch(&tpool->num_pops, 1, __ATOMIC_RELAXED);
+  int first = n % TPOOL_LOW_SHARE == 0 ? TPOOL_PRIO_LOW : TPOOL_PRIO_HIGH;
+
+  for (int i = 0; i < TPOOL_NUM_PRIO; ++i) {
+    *prio = (first + i) % TPOOL_NUM_PRIO;
+    if (queue_pop(&tpool->queues[*prio], routine, arg)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Tell if worker id must exit, because the pool is being destroyed or was shrunk below id.
+ * Retired workers are detached as nobody joins them. Called with queue_lock held */
+static int thread_exiting(int id) {
+  if (tpool->shutdown) {
+    return 1;
+  }
+  if (id < tpool->max_thr_num) {
+    return 0;
+  }
+  tpool->thr_alive[id] = 0;
+  pthread_detach(pthread_self());
+  return 1;
+}
+
 static void *thread_routine(void *arg) {
-  tpool_work_t *work;
+  int id = (int)(intptr_t)arg;
+  void *(*routine)(void *);
+  void *work_arg;
+  int prio;
 
   while (1) {
+    // shrinking the pool retires the workers with the highest ids, once they
+    // are done with their current work
+    if (__atomic_load_n(&tpool->shutdown, __ATOMIC_RELAXED) ||
+        id >= __atomic_load_n(&tpool->max_thr_num, __ATOMIC_RELAXED)) {
+      pthread_mutex_lock(&tpool->queue_lock);
+      if (thread_exiting(id)) {
+        pthread_mutex_unlock(&tpool->queue_lock);
+        return NULL;
+      }
+      pthread_mutex_unlock(&tpool->queue_lock);
+    }
 
+    if (queues_pop(&routine, &work_arg, &prio)) {
+      current_prio = prio;
+      routine(work_arg);
+      continue;
+    }
+
+    // announce the worker before looking at the ring again, a producer
+    // queueing in between either sees it parked or has its work seen here
     pthread_mutex_lock(&tpool->queue_lock);
-    while (!tpool->queue_head && !tpool->shutdown) {
+    __atomic_add_fetch(&tpool->num_idle, 1, __ATOMIC_SEQ_CST);
+    while (queues_empty() && !tpool->shutdown && id < tpool->max_thr_num) {
       pthread_cond_wait(&tpool->queue_ready, &tpool->queue_lock);
     }
-    if (tpool->shutdown) {
+    __atomic_sub_fetch(&tpool->num_idle, 1, __ATOMIC_SEQ_CST);
+    if (thread_exiting(id)) {
       pthread_mutex_unlock(&tpool->queue_lock);
-      pthread_exit(NULL);
+      return NULL;
     }
-    work = tpool->queue_head;
-    tpool->queue_head = tpool->queue_head->next;
     pthread_mutex_unlock(&tpool->queue_lock);
-
-    work->routine(work->arg);
-    free(work);
   }
 
   return NULL;
 }
 
-int tpool_create(int max_thr_num) {
-  int i;
+int tpool_create(int max_thr_num, int queue_size) {
+  int prio;
 
   tpool = calloc(1, sizeof(tpool_t));
   if (!tpool) {
@@ -41,9 +191,13 @@ int tpool_create(int max_thr_num) {
     return -1;
   }
 
-  tpool->max_thr_num = max_thr_num;
   tpool->shutdown = 0;
-  tpool->queue_head = NULL;
+  for (prio = 0; prio < TPOOL_NUM_PRIO; ++prio) {
+    if (queue_init(&tpool->queues[prio], queue_size) != 0) {
+      printf("%s: malloc failed\n", __FUNCTION__);
+      return -1;
+    }
+  }
   if (pthread_mutex_init(&tpool->queue_lock, NULL) != 0) {
     printf("%s: pthread_mutex_init failed, errno:%d, error:%s\n", __FUNCTION__, errno,
            strerror(errno));
@@ -55,43 +209,76 @@ int tpool_create(int max_thr_num) {
     return -1;
   }
 
-  tpool->thr_id = calloc(max_thr_num, sizeof(pthread_t));
-  if (!tpool->thr_id) {
-    printf("%s: calloc failed\n", __FUNCTION__);
+  return tpool_resize(max_thr_num);
+}
+
+int tpool_resize(int num_threads) {
+  int i, wanted = num_threads;
+
+  if (num_threads < 1) {
+    printf("%s:Invalid argument\n", __FUNCTION__);
     return -1;
   }
-  for (i = 0; i < max_thr_num; ++i) {
-    if (pthread_create(&tpool->thr_id[i], NULL, thread_routine, NULL) != 0) {
+
+  pthread_mutex_lock(&tpool->queue_lock);
+  if (num_threads > tpool->thr_cap) {
+    pthread_t *thr_id = realloc(tpool->thr_id, num_threads * sizeof(pthread_t));
+    char *thr_alive = realloc(tpool->thr_alive, num_threads);
+    if (thr_id) tpool->thr_id = thr_id;
+    if (thr_alive) tpool->thr_alive = thr_alive;
+    if (!thr_id || !thr_alive) {
+      printf("%s: realloc failed\n", __FUNCTION__);
+      pthread_mutex_unlock(&tpool->queue_lock);
+      return -1;
+    }
+    memset(tpool->thr_alive + tpool->thr_cap, 0, num_threads - tpool->thr_cap);
+    tpool->thr_cap = num_threads;
+  }
+
+  // workers still retiring from an earlier shrink are kept, they only leave
+  // once they see max_thr_num below their id
+  for (i = 0; i < num_threads; ++i) {
+    if (tpool->thr_alive[i]) {
+      continue;
+    }
+    if (pthread_create(&tpool->thr_id[i], NULL, thread_routine, (void *)(intptr_t)i) != 0) {
       printf("%s:pthread_create failed, errno:%d, error:%s\n", __FUNCTION__, errno,
              strerror(errno));
-      return -1;
+      num_threads = i;
+      break;
     }
+    tpool->thr_alive[i] = 1;
   }
+  __atomic_store_n(&tpool->max_thr_num, num_threads, __ATOMIC_RELAXED);
 
-  return 0;
+  // parked workers beyond the new size leave, busy ones after their work
+  pthread_cond_broadcast(&tpool->queue_ready);
+  pthread_mutex_unlock(&tpool->queue_lock);
+  return num_threads == wanted ? 0 : -1;
 }
 
 void tpool_destroy() {
   int i;
-  tpool_work_t *member;
 
+  pthread_mutex_lock(&tpool->queue_lock);
   if (tpool->shutdown) {
+    pthread_mutex_unlock(&tpool->queue_lock);
     return;
   }
   tpool->shutdown = 1;
-
-  pthread_mutex_lock(&tpool->queue_lock);
   pthread_cond_broadcast(&tpool->queue_ready);
   pthread_mutex_unlock(&tpool->queue_lock);
-  for (i = 0; i < tpool->max_thr_num; ++i) {
-    pthread_join(tpool->thr_id[i], NULL);
+
+  // retired workers are detached and no longer marked alive
+  for (i = 0; i < tpool->thr_cap; ++i) {
+    if (tpool->thr_alive[i]) {
+      pthread_join(tpool->thr_id[i], NULL);
+    }
   }
   free(tpool->thr_id);
-
-  while (tpool->queue_head) {
-    member = tpool->queue_head;
-    tpool->queue_head = tpool->queue_head->next;
-    free(member);
+  free(tpool->thr_alive);
+  for (i = 0; i < TPOOL_NUM_PRIO; ++i) {
+    free(tpool->queues[i].slots);
   }
 
   pthread_mutex_destroy(&tpool->queue_lock);
@@ -101,35 +288,107 @@ void tpool_destroy() {
 }
 
 int tpool_add_work(void *(*routine)(void *), void *arg) {
-  tpool_work_t *work, *member;
+  return tpool_add_work_prio(routine, arg, TPOOL_PRIO_HIGH);
+}
 
-  if (!routine) {
+int tpool_add_work_prio(void *(*routine)(void *), void *arg, int prio) {
+  if (!routine || prio < 0 || prio >= TPOOL_NUM_PRIO) {
     printf("%s:Invalid argument\n", __FUNCTION__);
     return -1;
   }
 
-  work = malloc(sizeof(tpool_work_t));
-  if (!work) {
-    printf("%s:malloc failed\n", __FUNCTION__);
+  // a full ring is left to the caller, which is usually about to reply
+  if (queue_push(&tpool->queues[prio], routine, arg) != 0) {
     return -1;
   }
-  work->routine = routine;
-  work->arg = arg;
-  work->next = NULL;
 
-  pthread_mutex_lock(&tpool->queue_lock);
-  member = tpool->queue_head;
-  if (!member) {
-    tpool->queue_head = work;
-  } else {
-    while (member->next) {
-      member = member->next;
+  // pairs with the increment of num_idle in thread_routine
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&tpool->num_idle, __ATOMIC_RELAXED) > 0) {
+    pthread_mutex_lock(&tpool->queue_lock);
+    pthread_cond_signal(&tpool->queue_ready);
+    pthread_mutex_unlock(&tpool->queue_lock);
+  }
+
+  return 0;
+}
+
+static void parallel_run(tpool_parallel_t *p) {
+  int i;
+  while ((i = __sync_fetch_and_add(&p->next, 1)) < p->n) {
+    p->routine(p->arg, i);
+    pthread_mutex_lock(&p->lock);
+    if (++p->done == p->n) {
+      pthread_cond_signal(&p->finished);
     }
-    member->next = work;
+    pthread_mutex_unlock(&p->lock);
   }
+}
 
-  pthread_cond_signal(&tpool->queue_ready);
-  pthread_mutex_unlock(&tpool->queue_lock);
+static void parallel_release(tpool_parallel_t *p) {
+  if (__sync_sub_and_fetch(&p->refcount, 1) == 0) {
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->finished);
+    free(p);
+  }
+}
+
+static void *parallel_helper(void *arg) {
+  __atomic_sub_fetch(&tpool->num_helpers, 1, __ATOMIC_SEQ_CST);
+  parallel_run(arg);
+  parallel_release(arg);
+  return NULL;
+}
 
+int tpool_run_parallel(int n, void (*routine)(void *, int), void *arg) {
+  tpool_parallel_t *p;
+  int i;
+
+  if (n <= 0) {
+    return 0;
+  }
+  p = calloc(1, sizeof(tpool_parallel_t));
+  if (!p) {
+    printf("%s:calloc failed\n", __FUNCTION__);
+    return -1;
+  }
+  p->routine = routine;
+  p->arg = arg;
+  p->n = n;
+  p->refcount = 1;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->finished, NULL);
+
+  for (i = 1; i < n && i < tpool_num_threads(); ++i) {
+    __sync_add_and_fetch(&p->refcount, 1);
+    __atomic_add_fetch(&tpool->num_helpers, 1, __ATOMIC_SEQ_CST);
+    if (tpool_add_work_prio(parallel_helper, p, current_prio) != 0) {
+      __atomic_sub_fetch(&tpool->num_helpers, 1, __ATOMIC_SEQ_CST);
+      __sync_sub_and_fetch(&p->refcount, 1);
+      break;
+    }
+  }
+
+  parallel_run(p);
+  pthread_mutex_lock(&p->lock);
+  while (p->done < n) {
+    pthread_cond_wait(&p->finished, &p->lock);
+  }
+  pthread_mutex_unlock(&p->lock);
+  parallel_release(p);
   return 0;
-}
\ No newline at end of file
+}
+
+int tpool_queue_depth() {
+  int prio, depth = 0;
+  for (prio = 0; prio < TPOOL_NUM_PRIO; ++prio) {
+    depth += queue_depth(&tpool->queues[prio]);
+  }
+  // a helper popped but not started yet is briefly left out twice
+  depth -= __atomic_load_n(&tpool->num_helpers, __ATOMIC_SEQ_CST);
+  return depth > 0 ? depth : 0;
+}
+
+int tpool_num_threads() {
+  return tpool ? __atomic_load_n(&tpool->max_thr_num, __ATOMIC_RELAXED) : 1;
+}
@@ -3,25 +3,83 @@
 
 #include <pthread.h>
 
+/* Default slots of each work queue. tpool_add_work fails when they are all taken */
+#define TPOOL_QUEUE_SIZE 16384
+
+/* Priority lanes, each with its own queue. Workers drain the high lane first but take from the
+ * low lane at least once every TPOOL_LOW_SHARE works while it has some, so it never starves */
+#define TPOOL_PRIO_HIGH 0
+#define TPOOL_PRIO_LOW 1
+#define TPOOL_NUM_PRIO 2
+#define TPOOL_LOW_SHARE 8
+
+/* A slot of the work ring. seq tells whose turn it is: it equals the ring position a producer may
+ * fill it for, and that position + 1 once it holds work for the consumer of that position */
 typedef struct tpool_work {
+  unsigned long seq;
   void *(*routine)(void *);
   void *arg;
-  struct tpool_work *next;
 } tpool_work_t;
 
+/*
+* Work is queued in a bounded lock-free multi producer multi consumer ring,
+* so the Redis main thread never waits on the workers to queue a search.
+* Producers and consumers claim positions with a CAS on their own counter,
+* kept on separate cache lines.
+*/
+typedef struct tpool_queue {
+  tpool_work_t *slots;
+  unsigned long mask;
+  char pad0[64];
+  unsigned long enqueue_pos;
+  char pad1[64];
+  unsigned long dequeue_pos;
+  char pad2[64];
+} tpool_queue_t;
+
+/* Workers only take queue_lock to park on queue_ready when every lane is empty, and producers
+ * only signal when some worker is parked */
 typedef struct tpool {
   int shutdown;
-  int max_thr_num;
+  int max_thr_num;   // wanted number of workers, worker i leaves once i >= max_thr_num
+  int thr_cap;       // size of thr_id and thr_alive
   pthread_t *thr_id;
-  tpool_work_t *queue_head;
+  char *thr_alive;   // set while worker i runs, cleared when it retires
+  tpool_queue_t queues[TPOOL_NUM_PRIO];
+  unsigned long num_pops;  // paces the turns of the low lane
+  int num_idle;  // workers parked or about to park on queue_ready
+  int num_helpers;  // helpers of tpool_run_parallel queued and not started yet
   pthread_mutex_t queue_lock;
   pthread_cond_t queue_ready;
 } tpool_t;
 
-int tpool_create(int max_thr_num);
+/* Start max_thr_num workers sharing a queue of queue_size slots per lane, rounded up to a power
+ * of 2 */
+int tpool_create(int max_thr_num, int queue_size);
+
+/* Grow or shrink the pool to num_threads workers. Queued work is kept, workers beyond the new size
+ * leave once they are done with the work they are running. Must not be called concurrently */
+int tpool_resize(int num_threads);
 
 void tpool_destroy();
 
+/* Queue work in the high lane */
 int tpool_add_work(void *(*routine)(void *), void *arg);
 
+/* Queue work in the lane of prio, TPOOL_PRIO_HIGH or TPOOL_PRIO_LOW */
+int tpool_add_work_prio(void *(*routine)(void *), void *arg, int prio);
+
+/* Run routine(arg, i) for every i in [0, n) on the pool, the calling thread
+ * included, and return once all of them are done. Work items are claimed one
+ * at a time, so a caller that is itself a pool thread gets through them alone
+ * when every other thread is busy instead of waiting on them. The helpers are
+ * queued in the lane of the work the calling pool thread is running. */
+int tpool_run_parallel(int n, void (*routine)(void *, int), void *arg);
+
+int tpool_num_threads();
+
+/* Number of queued works no worker took yet in all lanes, already stale when it returns. The
+ * helpers of tpool_run_parallel are left out, they only speed up work already counted */
+int tpool_queue_depth();
+
 #endif
\ No newline at end of file
@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include "vector.h"
 #include <stdio.h>
 
@@ -35,7 +38,7 @@ inline int Vector_Pop(Vector *v, void *ptr) {
 inline int __vector_PutPtr(Vector *v, size_t pos, void *elem) {
   // resize if pos is out of bounds
   if (pos >= v->cap) {
-    Vector_Resize(v, pos * 2);
+    Vector_Resize(v, pos ? pos * 2 : 1);
   }
 
   if (elem) {
@@ -80,9 +83,27 @@ void Vector_Free(Vector *v) {
   free(v);
 }
 
+#if defined(__APPLE__) || defined(__FreeBSD__)
 void Vector_Sort(Vector *v, void *arg, int (*compare)(void *, const void *, const void *)) {
   qsort_r((void *)v->data, Vector_Size(v), v->elemSize, arg, compare);
 }
+#else
+/* glibc's qsort_r passes the user argument last, adapt it to the BSD order */
+typedef struct {
+  void *arg;
+  int (*compare)(void *, const void *, const void *);
+} __sortThunk;
+
+static int __vector_sortThunk(const void *a, const void *b, void *arg) {
+  __sortThunk *t = arg;
+  return t->compare(t->arg, a, b);
+}
+
+void Vector_Sort(Vector *v, void *arg, int (*compare)(void *, const void *, const void *)) {
+  __sortThunk t = {arg, compare};
+  qsort_r((void *)v->data, Vector_Size(v), v->elemSize, __vector_sortThunk, &t);
+}
+#endif
 
 /* return the used size of the vector, regardless of capacity */
 inline size_t Vector_Size(Vector *v) {